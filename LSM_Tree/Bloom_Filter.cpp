@@ -8,6 +8,7 @@
 
 #include "Bloom_Filter.hpp"
 #include <math.h>
+#include <stdint.h>
 
 /*
  false positive error rate:p
@@ -54,6 +55,59 @@ bool BloomFilter::possiblyContains(int data){
     return true;
 };
 
+unsigned long int BloomFilter::size_in_bits(){
+    return m_bits.size();
+}
+
+/**
+ Write the parameters and the bits, eight to a byte
+ */
+void BloomFilter::write(std::ostream& out){
+    uint8_t format = FORMAT_BLOOM;
+    uint32_t hashes = m_numHashes;
+    uint64_t p = prime;
+    int32_t randoms[2] = {random1, random2};
+    uint64_t num_bits = m_bits.size();
+    std::vector<uint8_t> bytes((num_bits + 7)/8, 0);
+    for(uint64_t i = 0; i < num_bits; i++){
+        if(m_bits[i]) bytes[i/8] |= 1 << (i%8);
+    }
+    out.write((char*)&format, sizeof(format));
+    out.write((char*)&hashes, sizeof(hashes));
+    out.write((char*)&p, sizeof(p));
+    out.write((char*)randoms, sizeof(randoms));
+    out.write((char*)&num_bits, sizeof(num_bits));
+    out.write((char*)bytes.data(), bytes.size());
+}
+
+/**
+ Read a filter written by write, after its tag
+ @return NULL when the input ends early
+ */
+BloomFilter* BloomFilter::read(std::istream& in){
+    uint32_t hashes;
+    uint64_t p;
+    int32_t randoms[2];
+    uint64_t num_bits;
+    in.read((char*)&hashes, sizeof(hashes));
+    in.read((char*)&p, sizeof(p));
+    in.read((char*)randoms, sizeof(randoms));
+    in.read((char*)&num_bits, sizeof(num_bits));
+    if(!in) return NULL;
+    std::vector<uint8_t> bytes((num_bits + 7)/8);
+    if(!in.read((char*)bytes.data(), bytes.size())) return NULL;
+    BloomFilter* filter = new BloomFilter();
+    filter->m_numHashes = hashes;
+    filter->prime = p;
+    filter->random1 = randoms[0];
+    filter->random2 = randoms[1];
+    filter->m_bits.resize(num_bits);
+    for(uint64_t i = 0; i < num_bits; i++){
+        filter->m_bits[i] = (bytes[i/8] >> (i%8)) & 1;
+    }
+    return filter;
+}
+
 void BloomFilter::reset(){
     for(int i = 0; i < m_bits.size(); i++){
         m_bits.at(i) = false;
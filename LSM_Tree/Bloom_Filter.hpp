@@ -11,12 +11,12 @@
 
 #include <stdio.h>
 #include <vector>
-
+#include "Filter.hpp"
 
 /*
  definition of Bloom filter for inserting integer
  */
-class BloomFilter {
+class BloomFilter : public Filter {
     
     unsigned int m_numHashes;
     std::vector<bool> m_bits;
@@ -55,15 +55,18 @@ class BloomFilter {
     unsigned long int hashFunction(int a, int x){
         return ((a*x)%prime)%m_bits.size();
     };
-    
+    BloomFilter(){};
     
 public:
     const int SEED = 123454;
     BloomFilter(unsigned long int numEntries, double falsePosRate);
     void add(int data);
     bool possiblyContains(int data);
+    unsigned long int size_in_bits();
     void reset();
     unsigned long int ithHash(int i, int x);
+    void write(std::ostream& out);
+    static BloomFilter* read(std::istream& in);
 
 };
 
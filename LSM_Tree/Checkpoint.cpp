@@ -0,0 +1,124 @@
+//
+//  Checkpoint.cpp
+//  LSM_Tree
+//
+
+#include "Checkpoint.hpp"
+#include <fstream>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+
+/**
+ @return the file name of the path, without its directory
+ */
+std::string base_name(const std::string& path){
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/**
+ Give the file a second name, copying it when the new name is on another file system
+ or the file system has no hard links
+ */
+bool link_file(const std::string& from, const std::string& to){
+    if(link(from.c_str(), to.c_str()) == 0) return true;
+    if(errno != EXDEV && errno != EPERM && errno != ENOTSUP) return false;
+    std::ifstream in(from, std::ios::binary);
+    if(!in.is_open()) return false;
+    std::ofstream out(to, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    while(in.read(chunk.data(), chunk.size()) || in.gcount() > 0){
+        out.write(chunk.data(), in.gcount());
+    }
+    out.close();
+    if(out.good()) return true;
+    unlink(to.c_str());
+    return false;
+}
+
+/**
+ Write the metadata of a run to the manifest
+ @param file the name of the run file in the checkpoint
+ */
+void write_run(std::ostream& out, const Run& run, const std::string& file){
+    uint32_t name_length = file.size();
+    uint64_t size = run.size;
+    uint64_t tombstones = run.tombstones;
+    uint32_t range_tombstones = run.range_tombstones.size();
+    uint8_t has_filter = run.filter != NULL;
+    uint8_t has_index = run.index != NULL;
+    uint8_t has_summaries = run.summaries != NULL;
+    out.write((char*)&name_length, sizeof(name_length));
+    out.write(file.data(), name_length);
+    out.write((char*)&size, sizeof(size));
+    out.write((char*)&tombstones, sizeof(tombstones));
+    out.write((char*)&run.min_key, sizeof(run.min_key));
+    out.write((char*)&run.max_key, sizeof(run.max_key));
+    out.write((char*)&range_tombstones, sizeof(range_tombstones));
+    out.write((char*)run.range_tombstones.data(), range_tombstones*sizeof(RangeTombstone));
+    out.write((char*)&has_filter, sizeof(has_filter));
+    if(has_filter) run.filter->write(out);
+    out.write((char*)&has_index, sizeof(has_index));
+    if(has_index) run.index->write_directory(out);
+    //one summary per page of the index
+    out.write((char*)&has_summaries, sizeof(has_summaries));
+    if(has_summaries) out.write((char*)run.summaries, run.index->num_pages()*sizeof(PageSummary));
+    uint8_t continued = run.continued;
+    out.write((char*)&continued, sizeof(continued));
+}
+
+/**
+ Read back the metadata of a run written by write_run
+ @param dir the directory of the checkpoint, the run file is read for the blocks of its fence index
+ run stores the run, its name is the run file in the checkpoint
+ @return false when the manifest ends early or the run file can't be read, run holds nothing then
+ */
+bool read_run(std::istream& in, const std::string& dir, Run& run){
+    uint32_t name_length;
+    if(!in.read((char*)&name_length, sizeof(name_length))) return false;
+    std::string file(name_length, '\0');
+    uint64_t size, tombstones;
+    uint32_t range_tombstones;
+    uint8_t has_filter, has_index, has_summaries;
+    in.read(&file[0], name_length);
+    in.read((char*)&size, sizeof(size));
+    in.read((char*)&tombstones, sizeof(tombstones));
+    in.read((char*)&run.min_key, sizeof(run.min_key));
+    in.read((char*)&run.max_key, sizeof(run.max_key));
+    in.read((char*)&range_tombstones, sizeof(range_tombstones));
+    if(!in) return false;
+    run.name = dir + "/" + file;
+    run.size = size;
+    run.tombstones = tombstones;
+    run.range_tombstones.resize(range_tombstones);
+    in.read((char*)run.range_tombstones.data(), range_tombstones*sizeof(RangeTombstone));
+    bool ok = in.read((char*)&has_filter, sizeof(has_filter)).good();
+    if(ok && has_filter){
+        run.filter = read_filter(in);
+        ok = run.filter != NULL;
+    }
+    ok = ok && in.read((char*)&has_index, sizeof(has_index)).good();
+    if(ok && has_index){
+        run.index = FenceIndex::read_directory(in, run.name, run.size*sizeof(KVpair));
+        ok = run.index != NULL;
+    }
+    ok = ok && in.read((char*)&has_summaries, sizeof(has_summaries)).good();
+    if(ok && has_summaries){
+        ok = run.index != NULL;
+        if(ok){
+            run.summaries = new PageSummary[run.index->num_pages()];
+            ok = in.read((char*)run.summaries, run.index->num_pages()*sizeof(PageSummary)).good();
+        }
+    }
+    uint8_t continued = 0;
+    ok = ok && in.read((char*)&continued, sizeof(continued)).good();
+    run.continued = continued;
+    if(!ok){
+        delete run.filter;
+        delete run.index;
+        delete [] run.summaries;
+        run = Run();
+    }
+    return ok;
+}
@@ -0,0 +1,35 @@
+//
+//  Checkpoint.hpp
+//  LSM_Tree
+//
+
+#ifndef Checkpoint_hpp
+#define Checkpoint_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <iostream>
+#include "LSM.hpp"
+
+/*
+ A checkpoint is a directory holding a hard link to every run file of the tree and a
+ MANIFEST with what the tree keeps in memory about them: the sizes, the key ranges, the
+ range tombstones, the filters, the fence index directories, the page summaries and
+ whether the next run continues the run
+ The run files are never written once they are in a level, a merge writes a new file and
+ Layer::reset only removes the name of the old one, so the link keeps the file for the
+ checkpoint for as long as it needs it
+ 
+ MANIFEST: magic, version, page size, sequence number, number of levels, then for each
+ level its number of runs and the runs
+ */
+const char MANIFEST_MAGIC[4] = {'L', 'S', 'M', 'C'};
+const uint32_t MANIFEST_VERSION = 2;
+
+std::string base_name(const std::string& path);
+bool link_file(const std::string& from, const std::string& to);
+void write_run(std::ostream& out, const Run& run, const std::string& file);
+bool read_run(std::istream& in, const std::string& dir, Run& run);
+
+#endif /* Checkpoint_hpp */
@@ -0,0 +1,205 @@
+//
+//  Client.cpp
+//  LSM_Tree
+//
+
+#include "Client.hpp"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+using namespace std::chrono;
+
+Client::Client(const std::string& address){
+    fd = open_socket(address, false);
+}
+
+Client::~Client(){
+    if(fd >= 0) close(fd);
+}
+
+bool Client::connected(){
+    return fd >= 0;
+}
+
+/**
+ Send what the socket takes right now
+ @param sent the bytes of buf sent so far, advanced
+ @return false when the connection failed
+ */
+bool Client::send_some(const char* buf, unsigned long size, unsigned long& sent){
+    ssize_t n = send(fd, buf+sent, size-sent, MSG_DONTWAIT);
+    if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    sent += n;
+    return true;
+}
+
+/**
+ Append what has arrived to received
+ @return false when the connection failed or was closed
+ */
+bool Client::receive_some(){
+    char chunk[65536];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if(n == 0) return false;
+    if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    received.insert(received.end(), chunk, chunk+n);
+    return true;
+}
+
+void Client::put(int key, int value){
+    Request request = {REQ_PUT, key, value};
+    pending.push_back(request);
+}
+
+void Client::get(int key){
+    Request request = {REQ_GET, key, 0};
+    pending.push_back(request);
+}
+
+void Client::del(int key){
+    Request request = {REQ_DEL, key, 0};
+    pending.push_back(request);
+}
+
+void Client::range(int low, int high){
+    Request request = {REQ_RANGE, low, high};
+    pending.push_back(request);
+}
+
+void Client::del_range(int low, int high){
+    Request request = {REQ_DEL_RANGE, low, high};
+    pending.push_back(request);
+}
+
+/**
+ Send the queued requests and read their responses, reading whatever has arrived
+ whenever the socket doesn't take more requests, so a long pipeline or a large range
+ can't leave both sides waiting on each other
+
+ @param responses stores one response per request, in order
+ ranges when not NULL, stores the pairs of each range request, in order
+ @return false when the connection failed
+ */
+bool Client::flush(std::vector<Response>& responses, std::vector<std::vector<KVpair>>* ranges){
+    responses.resize(pending.size());
+    const char* out = (const char*)pending.data();
+    unsigned long size = pending.size()*sizeof(Request);
+    unsigned long sent = 0;
+    unsigned long next = 0;
+    unsigned long parsed = 0;
+    received.clear();
+    bool ok = true;
+    while(ok && next < pending.size()){
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN | (sent < size ? POLLOUT : 0);
+        p.revents = 0;
+        if(poll(&p, 1, -1) < 0){
+            ok = errno == EINTR;
+            continue;
+        }
+        if(p.revents & POLLOUT) ok = send_some(out, size, sent);
+        if(ok && (p.revents & (POLLIN | POLLHUP | POLLERR))) ok = receive_some();
+        //take the complete responses, a range one is complete once its pairs are in too
+        while(ok && next < pending.size() && received.size() - parsed >= sizeof(Response)){
+            Response response;
+            memcpy(&response, received.data()+parsed, sizeof(Response));
+            unsigned long length = sizeof(Response);
+            if(pending[next].type == REQ_RANGE) length += 2*(unsigned long)response.value*sizeof(int32_t);
+            if(received.size() - parsed < length) break;
+            responses[next] = response;
+            if(pending[next].type == REQ_RANGE && ranges != NULL){
+                const char* pairs = received.data()+parsed+sizeof(Response);
+                std::vector<KVpair> res(response.value);
+                for(int j = 0; j < res.size(); j++){
+                    int32_t pair[2];
+                    memcpy(pair, pairs+j*sizeof(pair), sizeof(pair));
+                    res[j].key = pair[0];
+                    res[j].value = pair[1];
+                    res[j].del = false;
+                }
+                ranges->push_back(res);
+            }
+            parsed += length;
+            next += 1;
+        }
+        //drop the responses taken once they are most of the buffer
+        if(parsed > received.size()/2){
+            received.erase(received.begin(), received.begin()+parsed);
+            parsed = 0;
+        }
+    }
+    pending.clear();
+    return ok;
+}
+
+/**
+ Load generator: each connection runs on its own thread and keeps sending
+ depth pipelined requests, then waiting for their responses
+
+ @param connections number of concurrent connections
+ depth number of requests sent before waiting for the responses
+ requests total number of requests over all the connections
+ key_range keys are drawn uniformly from [0, key_range)
+ get_ratio fraction of the requests that are lookups, the rest are puts
+ */
+void load_client(const std::string& address, int connections, int depth, unsigned long requests, int key_range, double get_ratio){
+    connections = std::max(connections, 1);
+    depth = std::max(depth, 1);
+    std::vector<std::vector<long>> latencies(connections);
+    std::vector<unsigned long> completed(connections, 0);
+    std::vector<std::thread> threads;
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    for(int c = 0; c < connections; c++){
+        threads.push_back(std::thread([&, c]{
+            Client client(address);
+            if(!client.connected()) return;
+            std::mt19937 gen(c);
+            std::uniform_int_distribution<int> keys(0, key_range-1);
+            std::uniform_real_distribution<double> mix(0, 1);
+            std::vector<Response> responses;
+            unsigned long share = requests/connections + (c < requests%connections ? 1 : 0);
+            while(completed[c] < share){
+                unsigned long n = std::min((unsigned long)depth, share-completed[c]);
+                for(unsigned long i = 0; i < n; i++){
+                    if(mix(gen) < get_ratio){
+                        client.get(keys(gen));
+                    }else{
+                        client.put(keys(gen), (int)i);
+                    }
+                }
+                high_resolution_clock::time_point start = high_resolution_clock::now();
+                if(!client.flush(responses)) return;
+                latencies[c].push_back(duration_cast<microseconds>(high_resolution_clock::now() - start).count());
+                completed[c] += n;
+            }
+        }));
+    }
+    for(int c = 0; c < connections; c++){
+        threads[c].join();
+    }
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    std::vector<long> all;
+    unsigned long total = 0;
+    for(int c = 0; c < connections; c++){
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        total += completed[c];
+    }
+    std::sort(all.begin(), all.end());
+    double seconds = duration_cast<microseconds>(t2 - t1).count()/1e6;
+    std::cout << total << " requests in " << seconds << " seconds, "
+    << (seconds > 0 ? total/seconds : 0) << " requests per second" << std::endl;
+    if(!all.empty()){
+        std::cout << "round trip of " << depth << " requests: median "
+        << all[all.size()/2] << " microseconds, p99 "
+        << all[all.size()*99/100] << " microseconds" << std::endl;
+    }
+}
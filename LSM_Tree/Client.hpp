@@ -0,0 +1,41 @@
+//
+//  Client.hpp
+//  LSM_Tree
+//
+
+#ifndef Client_hpp
+#define Client_hpp
+
+#include <stdio.h>
+#include "Server.hpp"
+#include <string>
+#include <vector>
+
+/*
+ Blocking client of the server, requests are pipelined: they are queued
+ and sent together, the responses come back in the same order
+ The responses are read while the requests are still being sent, the server stops
+ reading a connection that leaves too many responses unread
+ */
+class Client{
+    int fd;
+    std::vector<Request> pending;
+    std::vector<char> received;
+    bool send_some(const char* buf, unsigned long size, unsigned long& sent);
+    bool receive_some();
+
+public:
+    Client(const std::string& address);
+    ~Client();
+    bool connected();
+    void put(int key, int value);
+    void get(int key);
+    void del(int key);
+    void range(int low, int high);
+    void del_range(int low, int high);
+    bool flush(std::vector<Response>& responses, std::vector<std::vector<KVpair>>* ranges = NULL);
+};
+
+void load_client(const std::string& address, int connections, int depth, unsigned long requests, int key_range, double get_ratio);
+
+#endif /* Client_hpp */
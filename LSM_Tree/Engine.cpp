@@ -0,0 +1,130 @@
+//
+//  Engine.cpp
+//  LSM_Tree
+//
+
+#include "Engine.hpp"
+#include <sys/stat.h>
+
+/**
+ @param opts the options the keyspaces start from; the data directory and the level
+ directories hold one subdirectory per keyspace, the fence cache, the rate limit, the
+ tracing and the memory limit are shared by all of them
+ buffer_budget bytes shared by the buffers of the keyspaces, 0 to leave each buffer to its capacity
+ */
+Engine::Engine(const Options& opts, unsigned long buffer_budget){
+    options = opts;
+    this->buffer_budget = buffer_budget;
+    if(!options.data_dir.empty()){
+        mkdir(options.data_dir.c_str(), 0755);
+    }
+    for(int i = 0; i < options.level_dirs.size(); i++){
+        if(!options.level_dirs[i].empty()) mkdir(options.level_dirs[i].c_str(), 0755);
+    }
+    shared.engine = this;
+    //two workers are enough for one read-ahead and one write-behind at a time, merges run one at a time
+    shared.merge_io = create_io_backend(IO_THREADPOOL, 2);
+    //the memory limit holds for all the keyspaces together
+    shared.memory = new MemoryTracker(options.memory_limit);
+    if(options.fence_cache_bytes > 0){
+        shared.fence_cache = new FenceCache(options.fence_cache_bytes, shared.memory);
+    }
+    if(options.rate_limit > 0){
+        shared.rate_limiter = new RateLimiter(options.rate_limit);
+    }
+    if(options.trace_events > 0){
+        shared.tracer = new EventTracer(options.trace_events);
+    }
+}
+
+Engine::~Engine(){
+    //the trees drop their blocks from the fence cache on the way out
+    for(auto it = keyspaces.begin(); it != keyspaces.end(); ++it){
+        delete it->second;
+    }
+    delete shared.merge_io;
+    delete shared.fence_cache;
+    delete shared.rate_limiter;
+    delete shared.tracer;
+    delete shared.memory;
+}
+
+/**
+ @return the tracker of the memory all the keyspaces hold
+ */
+MemoryTracker* Engine::get_memory_tracker(){
+    for(auto it = keyspaces.begin(); it != keyspaces.end(); ++it){
+        it->second->account_memory();
+    }
+    return shared.memory;
+}
+
+Tree* Engine::create_keyspace(const std::string& name){
+    return create_keyspace(name, options);
+}
+
+/**
+ @param name names the subdirectory of the keyspace, without a slash
+ opts the options of the keyspace, its directories are replaced and the shared resources are the engine's
+ @return the tree of the keyspace, NULL when the name is taken or can't name a directory
+ */
+Tree* Engine::create_keyspace(const std::string& name, const Options& opts){
+    if(name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos) return NULL;
+    if(keyspaces.count(name) > 0) return NULL;
+    Options keyspace_options = opts;
+    keyspace_options.data_dir = (options.data_dir.empty() ? "" : options.data_dir + "/") + name;
+    keyspace_options.level_dirs = options.level_dirs;
+    for(int i = 0; i < options.level_dirs.size(); i++){
+        //an empty entry stays empty so the level falls back to the keyspace's data_dir
+        if(!options.level_dirs[i].empty()) keyspace_options.level_dirs[i] = options.level_dirs[i] + "/" + name;
+    }
+    Tree* tree = new Tree(keyspace_options, shared);
+    keyspaces[name] = tree;
+    buffered[tree] = 0;
+    return tree;
+}
+
+/**
+ @return the tree of the keyspace, NULL when there is none by that name
+ */
+Tree* Engine::keyspace(const std::string& name){
+    auto it = keyspaces.find(name);
+    return it == keyspaces.end() ? NULL : it->second;
+}
+
+std::vector<std::string> Engine::keyspace_names(){
+    std::vector<std::string> names;
+    for(auto it = keyspaces.begin(); it != keyspaces.end(); ++it){
+        names.push_back(it->first);
+    }
+    return names;
+}
+
+/**
+ @return the bytes of the writes waiting in the buffers of all the keyspaces
+ */
+unsigned long Engine::buffer_bytes(){
+    return total_buffered;
+}
+
+/**
+ Called by a keyspace after each write
+ Over the budget, the keyspace with the largest buffer is flushed and gives its memory back,
+ which frees the most with a single run
+ */
+void Engine::written(Tree* tree){
+    unsigned long& bytes = buffered[tree];
+    total_buffered += tree->buffer_bytes() - bytes;
+    bytes = tree->buffer_bytes();
+    if(buffer_budget == 0 || total_buffered <= buffer_budget) return;
+    Tree* largest = tree;
+    for(auto it = buffered.begin(); it != buffered.end(); ++it){
+        if(it->second > buffered[largest]) largest = it->first;
+    }
+    largest->flush();
+    largest->release_buffer();
+    total_buffered -= buffered[largest];
+    buffered[largest] = largest->buffer_bytes();
+    total_buffered += buffered[largest];
+    budget_flushes += 1;
+}
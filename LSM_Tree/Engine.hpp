@@ -0,0 +1,46 @@
+//
+//  Engine.hpp
+//  LSM_Tree
+//
+
+#ifndef Engine_hpp
+#define Engine_hpp
+
+#include <stdio.h>
+#include "Tree.hpp"
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+/*
+ Independent keyspaces on one set of resources: each keyspace is a tree with its own
+ options, levels and tuning, in its own subdirectory, while the merge workers, the fence
+ cache, the rate limiter, the tracer and the memory tracker are the engine's
+ The buffers of all the keyspaces share one budget: once their writes take more, the
+ largest buffer is flushed, so that a keyspace that sees few writes holds little memory
+ */
+class Engine{
+    Options options;
+    unsigned long buffer_budget;
+    SharedResources shared;
+    std::map<std::string, Tree*> keyspaces;
+    //bytes in the buffer of each keyspace as of its last write, and their sum
+    std::unordered_map<Tree*, unsigned long> buffered;
+    unsigned long total_buffered = 0;
+
+public:
+    //flushes made to stay within the buffer budget
+    unsigned long budget_flushes = 0;
+    Engine(const Options& opts, unsigned long buffer_budget);
+    ~Engine();
+    Tree* create_keyspace(const std::string& name);
+    Tree* create_keyspace(const std::string& name, const Options& opts);
+    Tree* keyspace(const std::string& name);
+    std::vector<std::string> keyspace_names();
+    unsigned long buffer_bytes();
+    MemoryTracker* get_memory_tracker();
+    void written(Tree* tree);
+};
+
+#endif /* Engine_hpp */
@@ -0,0 +1,140 @@
+//
+//  Event_Tracer.cpp
+//  LSM_Tree
+//
+
+#include "Event_Tracer.hpp"
+#include <fstream>
+#include <algorithm>
+
+using namespace std::chrono;
+
+//tells the tracers apart in the cache of each thread, even once one is deleted
+static std::atomic<unsigned long> next_tracer_id(1);
+
+/**
+ EventTracer
+ @param events_per_thread the size of the ring of each thread
+ */
+EventTracer::EventTracer(unsigned long events_per_thread){
+    id = next_tracer_id.fetch_add(1);
+    capacity = std::max(events_per_thread, 1ul);
+    origin = steady_clock::now();
+}
+
+EventTracer::~EventTracer(){
+    for(int i = 0; i < threads.size(); i++){
+        delete threads[i];
+    }
+}
+
+unsigned long EventTracer::now(){
+    return duration_cast<microseconds>(steady_clock::now() - origin).count();
+}
+
+/**
+ @return the ring of the calling thread, created the first time it records
+ */
+EventTracer::ThreadEvents* EventTracer::local(){
+    struct Cached{
+        unsigned long tracer;
+        ThreadEvents* events;
+    };
+    static thread_local Cached cached = {0, NULL};
+    if(cached.tracer == id) return cached.events;
+    std::lock_guard<std::mutex> guard(lock);
+    ThreadEvents* events = NULL;
+    for(int i = 0; i < threads.size() && events == NULL; i++){
+        if(threads[i]->thread == std::this_thread::get_id()) events = threads[i];
+    }
+    if(events == NULL){
+        events = new ThreadEvents();
+        events->thread = std::this_thread::get_id();
+        events->tid = (int)threads.size() + 1;
+        events->ring.resize(capacity);
+        events->recorded = 0;
+        threads.push_back(events);
+    }
+    cached.tracer = id;
+    cached.events = events;
+    return events;
+}
+
+/**
+ Only the calling thread writes its ring, the count is published after the event
+ */
+void EventTracer::record(const TraceEvent& event){
+    ThreadEvents* events = local();
+    unsigned long n = events->recorded.load(std::memory_order_relaxed);
+    events->ring[n % capacity] = event;
+    events->recorded.store(n + 1, std::memory_order_release);
+}
+
+/**
+ @return the number of events the rings hold
+ */
+unsigned long EventTracer::num_events(){
+    std::lock_guard<std::mutex> guard(lock);
+    unsigned long total = 0;
+    for(int i = 0; i < threads.size(); i++){
+        total += std::min(threads[i]->recorded.load(std::memory_order_acquire), capacity);
+    }
+    return total;
+}
+
+/**
+ Write the events as complete events ("ph":"X") of the Chrome trace format, one track per thread
+ An event a thread overwrites while it is exported can come out torn, export once the tree is quiet
+ */
+bool EventTracer::export_json(const std::string& file){
+    std::lock_guard<std::mutex> guard(lock);
+    std::ofstream out(file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for(int i = 0; i < threads.size(); i++){
+        unsigned long recorded = threads[i]->recorded.load(std::memory_order_acquire);
+        unsigned long begin = recorded > capacity ? recorded - capacity : 0;
+        for(unsigned long n = begin; n < recorded; n++){
+            const TraceEvent& e = threads[i]->ring[n % capacity];
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"ts\":" << e.start
+            << ",\"dur\":" << e.duration << ",\"pid\":1,\"tid\":" << threads[i]->tid << ",\"args\":{";
+            for(int a = 0; a < 3 && e.arg_names[a] != NULL; a++){
+                out << (a > 0 ? "," : "") << "\"" << e.arg_names[a] << "\":" << e.args[a];
+            }
+            out << "}}";
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+/**
+ TraceSpan
+ */
+TraceSpan::TraceSpan(EventTracer* tracer, const char* name, const char* category, unsigned long min_duration){
+    this->tracer = tracer;
+    this->min_duration = min_duration;
+    if(tracer == NULL) return;
+    event.name = name;
+    event.category = category;
+    event.start = tracer->now();
+    event.arg_names[0] = event.arg_names[1] = event.arg_names[2] = NULL;
+}
+
+TraceSpan::~TraceSpan(){
+    if(tracer == NULL) return;
+    event.duration = tracer->now() - event.start;
+    if(event.duration >= min_duration) tracer->record(event);
+}
+
+/**
+ Attach a number to the span, up to three
+ */
+void TraceSpan::arg(const char* name, long value){
+    if(tracer == NULL || num_args == 3) return;
+    event.arg_names[num_args] = name;
+    event.args[num_args] = value;
+    num_args += 1;
+}
@@ -0,0 +1,76 @@
+//
+//  Event_Tracer.hpp
+//  LSM_Tree
+//
+
+#ifndef Event_Tracer_hpp
+#define Event_Tracer_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+/*
+ A span of time spent on something, names and argument names are string literals
+ */
+struct TraceEvent{
+    const char* name;
+    const char* category;
+    //microseconds since the tracer was created
+    unsigned long start;
+    unsigned long duration;
+    const char* arg_names[3];
+    long args[3];
+};
+
+/*
+ Records spans into a ring of each thread, so recording takes no lock; a ring keeps
+ the last events of its thread, the older ones are overwritten
+ The events export to the Chrome trace format, which chrome://tracing and Perfetto open
+ */
+class EventTracer{
+    struct ThreadEvents{
+        std::thread::id thread;
+        int tid;
+        std::vector<TraceEvent> ring;
+        //events recorded so far, the ring holds the last ones
+        std::atomic<unsigned long> recorded;
+    };
+    unsigned long id;
+    unsigned long capacity;
+    std::chrono::steady_clock::time_point origin;
+    //taken when a thread records for the first time and to export
+    std::mutex lock;
+    std::vector<ThreadEvents*> threads;
+    ThreadEvents* local();
+
+public:
+    EventTracer(unsigned long events_per_thread);
+    ~EventTracer();
+    unsigned long now();
+    void record(const TraceEvent& event);
+    unsigned long num_events();
+    bool export_json(const std::string& file);
+};
+
+/*
+ Records the time from its creation to its destruction, nothing when the tracer is NULL
+ or the span is shorter than the minimum duration
+ */
+class TraceSpan{
+    EventTracer* tracer;
+    unsigned long min_duration;
+    TraceEvent event;
+    int num_args = 0;
+
+public:
+    TraceSpan(EventTracer* tracer, const char* name, const char* category, unsigned long min_duration = 0);
+    ~TraceSpan();
+    void arg(const char* name, long value);
+};
+
+#endif /* Event_Tracer_hpp */
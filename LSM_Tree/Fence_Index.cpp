@@ -0,0 +1,318 @@
+//
+//  Fence_Index.cpp
+//  LSM_Tree
+//
+
+#include "Fence_Index.hpp"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ FenceCache
+ */
+
+/**
+ @param memory charged with the cached blocks as they come and go, NULL for no accounting
+ */
+FenceCache::FenceCache(unsigned long capacity, MemoryTracker* memory){
+    this->capacity = capacity;
+    this->memory = memory;
+}
+
+FenceCache::~FenceCache(){
+    if(memory != NULL) memory->charge(MEMORY_CACHES, -(long)used);
+}
+
+/**
+ @return the bytes of the block, NULL when it is not cached
+ */
+const uint8_t* FenceCache::get(const FenceIndex* index, int block){
+    auto it = lookup.find(std::make_pair(index, block));
+    if(it == lookup.end()){
+        misses += 1;
+        return NULL;
+    }
+    hits += 1;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->bytes.data();
+}
+
+/**
+ Cache a block read from a run file, the bytes are moved in
+ The returned bytes stay valid until the next put
+ */
+const uint8_t* FenceCache::put(const FenceIndex* index, int block, std::vector<uint8_t>& bytes){
+    Entry entry;
+    entry.index = index;
+    entry.block = block;
+    entry.bytes.swap(bytes);
+    used += entry.bytes.size();
+    if(memory != NULL) memory->charge(MEMORY_CACHES, entry.bytes.size());
+    entries.push_front(entry);
+    lookup[std::make_pair(index, block)] = entries.begin();
+    //the new block stays even when it is larger than the capacity on its own
+    while(used > capacity && entries.size() > 1){
+        Entry& victim = entries.back();
+        used -= victim.bytes.size();
+        if(memory != NULL) memory->charge(MEMORY_CACHES, -(long)victim.bytes.size());
+        lookup.erase(std::make_pair(victim.index, victim.block));
+        entries.pop_back();
+    }
+    return entries.front().bytes.data();
+}
+
+/**
+ Drop the blocks of an index that is deleted
+ */
+void FenceCache::erase(const FenceIndex* index){
+    for(auto it = entries.begin(); it != entries.end();){
+        if(it->index == index){
+            used -= it->bytes.size();
+            if(memory != NULL) memory->charge(MEMORY_CACHES, -(long)it->bytes.size());
+            lookup.erase(std::make_pair(it->index, it->block));
+            it = entries.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+unsigned long FenceCache::size_in_bytes(){
+    return used;
+}
+
+/**
+ FenceIndex
+ */
+
+void put_varint(std::vector<uint8_t>& out, uint32_t value){
+    while(value >= 0x80){
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+uint32_t get_varint(const uint8_t*& in){
+    uint32_t value = 0;
+    int shift = 0;
+    while(*in & 0x80){
+        value |= (uint32_t)(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (uint32_t)(*in++) << shift;
+    return value;
+}
+
+/**
+ @param mins the smallest key of each page, in order
+ last_key the largest key of the run
+ block_pages the number of pages in a block
+ */
+FenceIndex::FenceIndex(const std::vector<int>& mins, int last_key, unsigned int block_pages){
+    this->block_pages = std::max(block_pages, 1u);
+    this->last_key = last_key;
+    pages = (int)mins.size();
+    for(int i = 0; i < pages; i++){
+        if(i % this->block_pages == 0){
+            Block b;
+            b.first_key = mins[i];
+            b.offset = (uint32_t)encoded.size();
+            directory.push_back(b);
+        }else{
+            //keys don't decrease, the difference is taken modulo 2^32 to stay clear of overflow
+            put_varint(encoded, (uint32_t)mins[i] - (uint32_t)mins[i-1]);
+        }
+    }
+    encoded_size = (uint32_t)encoded.size();
+}
+
+FenceIndex::~FenceIndex(){
+    if(cache != NULL) cache->erase(this);
+}
+
+int FenceIndex::num_pages() const{
+    return pages;
+}
+
+int FenceIndex::max_key() const{
+    return last_key;
+}
+
+/**
+ @return the encoded differences of the block, from memory, the cache or the run file
+ */
+const uint8_t* FenceIndex::block(int b) const{
+    if(cache == NULL) return encoded.data() + directory[b].offset;
+    const uint8_t* bytes = cache->get(this, b);
+    if(bytes != NULL) return bytes;
+    uint32_t end = b + 1 < directory.size() ? directory[b+1].offset : encoded_size;
+    //one spare byte, so that an empty block still has an address
+    std::vector<uint8_t> read(end - directory[b].offset + 1);
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0 || pread(fd, read.data(), read.size()-1, section_offset + directory[b].offset) != (ssize_t)(read.size()-1)){
+        std::cout<<"Error reading the fence index"<<std::endl;
+    }
+    if(fd >= 0) close(fd);
+    return cache->put(this, b, read);
+}
+
+/**
+ @return the first page whose smallest key is not below the key, num_pages() when none
+ */
+int FenceIndex::lower_page(int key) const{
+    //the first block whose first key is not below the key
+    int lo = 0;
+    int hi = (int)directory.size();
+    while(lo < hi){
+        int mid = (lo + hi)/2;
+        if(directory[mid].first_key < key){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    if(lo == 0) return 0;
+    //the page is in the block before it, or is the first page of that block
+    int b = lo - 1;
+    int page = b*block_pages;
+    int end = std::min(page + (int)block_pages, pages);
+    uint32_t min = (uint32_t)directory[b].first_key;
+    const uint8_t* in = block(b);
+    for(page += 1; page < end; page++){
+        min += get_varint(in);
+        if((int)min >= key) return page;
+    }
+    return end;
+}
+
+/**
+ The pages that can hold the key: the pages starting with it, and the page before them,
+ which can end with it
+
+ @param first stores the first of them
+ last stores the last of them
+ @return false when no page can hold the key
+ */
+bool FenceIndex::find(int key, int& first, int& last) const{
+    if(pages == 0 || key > last_key) return false;
+    int after = key == INT_MAX ? pages : lower_page(key + 1);
+    if(after == 0) return false;
+    first = std::max(lower_page(key) - 1, 0);
+    last = after - 1;
+    return true;
+}
+
+/**
+ The pages that can hold keys within [low, high)
+ @return false when none can
+ */
+bool FenceIndex::overlap(int low, int high, int& first, int& last) const{
+    if(pages == 0 || low >= high || last_key < low) return false;
+    first = std::max(lower_page(low) - 1, 0);
+    last = lower_page(high) - 1;
+    return last >= first;
+}
+
+/**
+ Decode the smallest keys of pages [first, last]
+ @param mins stores them, followed by the smallest key of page last+1, or the largest key
+ of the run after the last page, so that page i ends at most at mins[i-first+1]
+ */
+void FenceIndex::page_mins(int first, int last, std::vector<int>& mins) const{
+    mins.clear();
+    int b = first/block_pages;
+    uint32_t min = (uint32_t)directory[b].first_key;
+    const uint8_t* in = block(b);
+    int end = std::min(last + 1, pages - 1);
+    int page = b*block_pages;
+    while(true){
+        if(page >= first) mins.push_back((int)min);
+        page += 1;
+        if(page > end) break;
+        //the first key of a block is in the directory
+        if(page % block_pages == 0){
+            b = page/block_pages;
+            min = (uint32_t)directory[b].first_key;
+            in = block(b);
+        }else{
+            min += get_varint(in);
+        }
+    }
+    if(last + 1 >= pages) mins.push_back(last_key);
+}
+
+/**
+ Append the blocks to the run file, the index section starts right after the KVpairs
+ */
+bool FenceIndex::write(const std::string& run_file) const{
+    std::ofstream out(run_file, std::ios::binary | std::ios::app);
+    out.write((const char*)encoded.data(), encoded.size());
+    return out.good();
+}
+
+/**
+ Write what the index keeps besides its blocks, the blocks are in the run file already
+ */
+void FenceIndex::write_directory(std::ostream& out) const{
+    uint32_t blocks = directory.size();
+    out.write((char*)&pages, sizeof(pages));
+    out.write((char*)&last_key, sizeof(last_key));
+    out.write((char*)&block_pages, sizeof(block_pages));
+    out.write((char*)&encoded_size, sizeof(encoded_size));
+    out.write((char*)&blocks, sizeof(blocks));
+    out.write((char*)directory.data(), blocks*sizeof(Block));
+}
+
+/**
+ Read back an index written by write_directory, with its blocks from the index section of the run file
+ @param offset where the index section starts in the run file
+ @return NULL when the input ends early or the section can't be read
+ */
+FenceIndex* FenceIndex::read_directory(std::istream& in, const std::string& run_file, unsigned long offset){
+    FenceIndex* index = new FenceIndex();
+    uint32_t blocks;
+    in.read((char*)&index->pages, sizeof(index->pages));
+    in.read((char*)&index->last_key, sizeof(index->last_key));
+    in.read((char*)&index->block_pages, sizeof(index->block_pages));
+    in.read((char*)&index->encoded_size, sizeof(index->encoded_size));
+    in.read((char*)&blocks, sizeof(blocks));
+    if(in){
+        index->directory.resize(blocks);
+        in.read((char*)index->directory.data(), blocks*sizeof(Block));
+    }
+    index->encoded.resize(index->encoded_size);
+    int fd = open(run_file.c_str(), O_RDONLY);
+    bool ok = in && fd >= 0 && pread(fd, index->encoded.data(), index->encoded_size, offset) == (ssize_t)index->encoded_size;
+    if(fd >= 0) close(fd);
+    if(!ok){
+        delete index;
+        return NULL;
+    }
+    return index;
+}
+
+/**
+ Drop the blocks from memory, they are read from the index section of the run file when needed
+
+ @param offset where the index section starts in the run file
+ */
+void FenceIndex::make_lazy(const std::string& run_file, unsigned long offset, FenceCache* fence_cache){
+    if(fence_cache == NULL) return;
+    if(cache != NULL) cache->erase(this);
+    file = run_file;
+    section_offset = offset;
+    cache = fence_cache;
+    std::vector<uint8_t>().swap(encoded);
+}
+
+/**
+ @return the memory the index keeps for itself, the cached blocks are not counted
+ */
+unsigned long FenceIndex::size_in_bytes() const{
+    return directory.size()*sizeof(Block) + encoded.capacity();
+}
@@ -0,0 +1,90 @@
+//
+//  Fence_Index.hpp
+//  LSM_Tree
+//
+
+#ifndef Fence_Index_hpp
+#define Fence_Index_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <iostream>
+#include "Memory_Tracker.hpp"
+
+class FenceIndex;
+
+/*
+ Index blocks of the runs of the deep levels read back from their files,
+ the least recently used blocks are dropped to stay within capacity bytes
+ */
+class FenceCache{
+    struct Entry{
+        const FenceIndex* index;
+        int block;
+        std::vector<uint8_t> bytes;
+    };
+    unsigned long capacity;
+    unsigned long used = 0;
+    MemoryTracker* memory;
+    std::list<Entry> entries;
+    std::map<std::pair<const FenceIndex*, int>, std::list<Entry>::iterator> lookup;
+
+public:
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    FenceCache(unsigned long capacity, MemoryTracker* memory = NULL);
+    ~FenceCache();
+    const uint8_t* get(const FenceIndex* index, int block);
+    const uint8_t* put(const FenceIndex* index, int block, std::vector<uint8_t>& bytes);
+    void erase(const FenceIndex* index);
+    unsigned long size_in_bytes();
+};
+
+/*
+ Fence index of a run: only the smallest key of each page is kept, a page ends at
+ most at the smallest key of the next one since the run is sorted
+ The keys are split into blocks of block_pages pages; a block is the difference of
+ each key from the one before it, as varints, and only the first key of each block
+ stays in the directory
+ The blocks are also written after the KVpairs of the run file, the index section,
+ so the index of a lazy run only keeps its directory and reads the blocks on demand
+ */
+class FenceIndex{
+    struct Block{
+        int first_key;
+        uint32_t offset;
+    };
+    std::vector<Block> directory;
+    std::vector<uint8_t> encoded;
+    uint32_t encoded_size = 0;
+    int pages = 0;
+    int last_key;
+    unsigned int block_pages;
+    //where the blocks come from when lazy
+    FenceCache* cache = NULL;
+    std::string file;
+    unsigned long section_offset = 0;
+    const uint8_t* block(int b) const;
+    FenceIndex(){};
+
+public:
+    FenceIndex(const std::vector<int>& mins, int last_key, unsigned int block_pages);
+    ~FenceIndex();
+    int num_pages() const;
+    int lower_page(int key) const;
+    bool find(int key, int& first, int& last) const;
+    bool overlap(int low, int high, int& first, int& last) const;
+    void page_mins(int first, int last, std::vector<int>& mins) const;
+    int max_key() const;
+    bool write(const std::string& run_file) const;
+    void write_directory(std::ostream& out) const;
+    static FenceIndex* read_directory(std::istream& in, const std::string& run_file, unsigned long offset);
+    void make_lazy(const std::string& run_file, unsigned long offset, FenceCache* fence_cache);
+    unsigned long size_in_bytes() const;
+};
+
+#endif /* Fence_Index_hpp */
@@ -0,0 +1,36 @@
+//
+//  Filter.hpp
+//  LSM_Tree
+//
+
+#ifndef Filter_hpp
+#define Filter_hpp
+
+#include <stdio.h>
+#include <iostream>
+
+enum FilterType{
+    FILTER_BLOOM,
+    FILTER_XOR
+};
+
+//tag of each kind of filter when written, read_filter goes by it
+enum FilterFormat{
+    FORMAT_BLOOM = 0,
+    FORMAT_XOR = 1
+};
+
+/*
+ Membership filter of a run, answers false only when the key is surely not in the run
+ */
+class Filter{
+public:
+    virtual ~Filter(){};
+    virtual bool possiblyContains(int data) = 0;
+    //memory used by the filter
+    virtual unsigned long int size_in_bits() = 0;
+    //the filter behind its tag, as read_filter reads it back
+    virtual void write(std::ostream& out) = 0;
+};
+
+#endif /* Filter_hpp */
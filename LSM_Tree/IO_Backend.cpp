@@ -0,0 +1,371 @@
+//
+//  IO_Backend.cpp
+//  LSM_Tree
+//
+
+#include "IO_Backend.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+void init_request(IORequest& request, int fd, bool write, unsigned long offset, unsigned long length, char* buf){
+    request.fd = fd;
+    request.write = write;
+    request.offset = offset;
+    request.length = length;
+    request.buf = buf;
+    request.result = 0;
+    request.done = false;
+}
+
+/**
+ Do the whole request with blocking calls, retry on short transfers
+ @return bytes transferred, -1 on error
+ */
+long blocking_io(IORequest& request){
+    unsigned long transferred = 0;
+    while(transferred < request.length){
+        ssize_t n;
+        if(request.write){
+            n = pwrite(request.fd, request.buf + transferred, request.length - transferred, request.offset + transferred);
+        }else{
+            n = pread(request.fd, request.buf + transferred, request.length - transferred, request.offset + transferred);
+        }
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(n == 0) break; //end of file
+        transferred += n;
+    }
+    return transferred;
+}
+
+/**
+ Submit all the requests before waiting for any, so the device sees all of them at once
+ */
+void IOBackend::run_batch(std::vector<IORequest>& requests){
+    for(int i = 0; i < requests.size(); i++){
+        submit(&requests[i]);
+    }
+    for(int i = 0; i < requests.size(); i++){
+        wait(&requests[i]);
+    }
+}
+
+/**
+ SyncIO
+ */
+
+void SyncIO::submit(IORequest* request){
+    request->result = blocking_io(*request);
+    request->done = true;
+}
+
+void SyncIO::wait(IORequest* /*request*/){
+}
+
+std::string SyncIO::name(){
+    return "sync";
+}
+
+/**
+ ThreadPoolIO
+ */
+
+ThreadPoolIO::ThreadPoolIO(int num_threads){
+    //room for the reads of the runs of a lookup, so queueing them doesn't allocate
+    queue.reserve(256);
+    for(int i = 0; i < num_threads; i++){
+        workers.push_back(std::thread(&ThreadPoolIO::work, this));
+    }
+}
+
+ThreadPoolIO::~ThreadPoolIO(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    has_work.notify_all();
+    for(int i = 0; i < workers.size(); i++){
+        workers[i].join();
+    }
+}
+
+void ThreadPoolIO::work(){
+    while(true){
+        IORequest* request;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            has_work.wait(guard, [this]{ return stop || head < queue.size(); });
+            if(head == queue.size()) return;
+            request = queue[head];
+            head += 1;
+            if(head == queue.size()){
+                queue.clear();
+                head = 0;
+            }
+        }
+        long result = blocking_io(*request);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            request->result = result;
+            request->done = true;
+        }
+        has_done.notify_all();
+    }
+}
+
+void ThreadPoolIO::submit(IORequest* request){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        request->done = false;
+        if(head > 0 && queue.size() == queue.capacity()){
+            //reuse the room of the requests taken already before growing
+            queue.erase(queue.begin(), queue.begin()+head);
+            head = 0;
+        }
+        queue.push_back(request);
+    }
+    has_work.notify_one();
+}
+
+void ThreadPoolIO::wait(IORequest* request){
+    std::unique_lock<std::mutex> guard(lock);
+    has_done.wait(guard, [request]{ return request->done; });
+}
+
+std::string ThreadPoolIO::name(){
+    return "threadpool";
+}
+
+/**
+ UringIO
+ Uses the raw system calls so there is no dependency on liburing
+ reference: https://kernel.dk/io_uring.pdf
+ */
+#ifdef __linux__
+
+UringIO::UringIO(unsigned int queue_depth){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = (int)syscall(__NR_io_uring_setup, queue_depth, &params);
+    if(ring_fd < 0) return;
+    entries = params.sq_entries;
+    sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap){
+        sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        cq_ring_size = sq_ring_size;
+    }
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED){
+        sq_ring = NULL;
+        return;
+    }
+    if(single_mmap){
+        cq_ring = sq_ring;
+    }else{
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED){
+            cq_ring = NULL;
+            return;
+        }
+    }
+    sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        sqes = NULL;
+        return;
+    }
+    sq_head = (unsigned int*)((char*)sq_ring + params.sq_off.head);
+    sq_tail = (unsigned int*)((char*)sq_ring + params.sq_off.tail);
+    sq_mask = (unsigned int*)((char*)sq_ring + params.sq_off.ring_mask);
+    sq_array = (unsigned int*)((char*)sq_ring + params.sq_off.array);
+    cq_head = (unsigned int*)((char*)cq_ring + params.cq_off.head);
+    cq_tail = (unsigned int*)((char*)cq_ring + params.cq_off.tail);
+    cq_mask = (unsigned int*)((char*)cq_ring + params.cq_off.ring_mask);
+    cqes = (char*)cq_ring + params.cq_off.cqes;
+}
+
+UringIO::~UringIO(){
+    while(in_flight + pending > 0){
+        if(failed || !enter(1)) std::this_thread::yield();
+        reap();
+    }
+    if(sqes != NULL) munmap(sqes, sqes_size);
+    if(cq_ring != NULL && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+    if(sq_ring != NULL) munmap(sq_ring, sq_ring_size);
+    if(ring_fd >= 0) close(ring_fd);
+}
+
+bool UringIO::valid(){
+    return ring_fd >= 0 && sq_ring != NULL && cq_ring != NULL && sqes != NULL;
+}
+
+/**
+ Submit the queued entries to the kernel
+ @param min_complete when positive, also block until that many requests have completed
+ @return false when the system call failed, the backend has switched to blocking calls then
+ */
+bool UringIO::enter(unsigned int min_complete){
+    unsigned int flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while(true){
+        int ret = (int)syscall(__NR_io_uring_enter, ring_fd, pending, min_complete, flags, NULL, 0);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            fail();
+            return false;
+        }
+        pending -= ret;
+        in_flight += ret;
+        return true;
+    }
+}
+
+/**
+ Stop using the ring: the queued entries the kernel has not taken are withdrawn and done
+ with blocking calls, as are the later requests
+ The requests the kernel has taken still complete through the completion ring
+ */
+void UringIO::fail(){
+    if(!failed) std::cout<<"io_uring_enter failed: "<<strerror(errno)<<", using blocking calls"<<std::endl;
+    failed = true;
+    //without SQPOLL the kernel only takes entries in io_uring_enter, the tail can go back
+    unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = *sq_tail;
+    for(unsigned int i = head; i != tail; i++){
+        struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes + sq_array[i & *sq_mask];
+        IORequest* request = (IORequest*)sqe->user_data;
+        request->result = blocking_io(*request);
+        request->done = true;
+    }
+    __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+    pending = 0;
+}
+
+/**
+ Mark the requests in the completion ring as done
+ */
+void UringIO::reap(){
+    unsigned int head = *cq_head;
+    unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail){
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*)cqes + (head & *cq_mask);
+        IORequest* request = (IORequest*)cqe->user_data;
+        if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP){
+            //the kernel does not know the opcode (older than 5.6)
+            request->result = blocking_io(*request);
+        }else if(cqe->res < 0){
+            request->result = -1;
+        }else if(cqe->res < request->length && cqe->res > 0){
+            //short transfer, finish the rest with a blocking call
+            IORequest rest;
+            init_request(rest, request->fd, request->write, request->offset + cqe->res, request->length - cqe->res, request->buf + cqe->res);
+            long more = blocking_io(rest);
+            request->result = more < 0 ? -1 : cqe->res + more;
+        }else{
+            request->result = cqe->res;
+        }
+        request->done = true;
+        in_flight -= 1;
+        head += 1;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void UringIO::submit(IORequest* request){
+    request->done = false;
+    while(!failed && pending + in_flight >= entries){
+        //the rings are full, make room first
+        if(!enter(1)) break;
+        reap();
+    }
+    if(failed){
+        request->result = blocking_io(*request);
+        request->done = true;
+        return;
+    }
+    unsigned int tail = *sq_tail;
+    unsigned int index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = request->fd;
+    sqe->off = request->offset;
+    sqe->addr = (unsigned long)request->buf;
+    sqe->len = (unsigned int)request->length;
+    sqe->user_data = (unsigned long)request;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    pending += 1;
+}
+
+/**
+ Queued requests are only handed to the kernel here, so requests submitted together go in one system call
+ */
+void UringIO::wait(IORequest* request){
+    reap();
+    while(!request->done){
+        //after a failure, only the requests the kernel has taken are left to complete
+        if(failed || !enter(1)) std::this_thread::yield();
+        reap();
+    }
+}
+
+std::string UringIO::name(){
+    return "io_uring";
+}
+
+#endif
+
+/**
+ Create a backend
+ @param type the wanted backend
+ queue_depth the number of requests the backend keeps in flight
+ @return the backend, io_uring falls back to the thread pool when it is not available
+ */
+IOBackend* create_io_backend(IOBackendType type, int queue_depth){
+    switch (type) {
+        case IO_SYNC:
+            return new SyncIO();
+        case IO_URING:
+#ifdef __linux__
+        {
+            UringIO* uring = new UringIO(queue_depth);
+            if(uring->valid()) return uring;
+            delete uring;
+        }
+#endif
+            std::cout<<"io_uring not available, using the thread pool"<<std::endl;
+            return new ThreadPoolIO(queue_depth);
+        default:
+            return new ThreadPoolIO(queue_depth);
+    }
+}
+
+/**
+ @param name the name of a backend: "sync", "threadpool" or "io_uring"
+ type stores the backend
+ @return false when there is no backend by that name
+ */
+bool parse_io_backend(const std::string& name, IOBackendType& type){
+    if(name == "sync"){
+        type = IO_SYNC;
+    }else if(name == "threadpool"){
+        type = IO_THREADPOOL;
+    }else if(name == "io_uring"){
+        type = IO_URING;
+    }else{
+        return false;
+    }
+    return true;
+}
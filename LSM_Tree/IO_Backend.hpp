@@ -0,0 +1,118 @@
+//
+//  IO_Backend.hpp
+//  LSM_Tree
+//
+
+#ifndef IO_Backend_hpp
+#define IO_Backend_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum IOBackendType{
+    IO_SYNC,        //one blocking pread at a time, queue depth 1
+    IO_THREADPOOL,  //blocking preads spread over worker threads
+    IO_URING        //linux io_uring, falls back to the thread pool when unavailable
+};
+
+/*
+ One page sized read or write on an open file
+ done is set by the backend once result is valid
+ */
+struct IORequest{
+    int fd;
+    bool write;
+    unsigned long offset;   //in bytes
+    unsigned long length;   //in bytes
+    char* buf;
+    long result;            //bytes transferred, -1 on error
+    bool done;
+};
+
+void init_request(IORequest& request, int fd, bool write, unsigned long offset, unsigned long length, char* buf);
+long blocking_io(IORequest& request);
+
+/*
+ Interface of the I/O backends
+ submit only starts a request, the request and its buffer must stay alive until wait returns
+ */
+class IOBackend{
+public:
+    virtual ~IOBackend(){};
+    virtual void submit(IORequest* request) = 0;
+    virtual void wait(IORequest* request) = 0;
+    virtual std::string name() = 0;
+    void run_batch(std::vector<IORequest>& requests);
+};
+
+class SyncIO: public IOBackend{
+public:
+    void submit(IORequest* request);
+    void wait(IORequest* request);
+    std::string name();
+};
+
+class ThreadPoolIO: public IOBackend{
+    std::vector<std::thread> workers;
+    //requests from head on wait for a worker, the vector is only cleared so it doesn't allocate again
+    std::vector<IORequest*> queue;
+    unsigned long head = 0;
+    std::mutex lock;
+    std::condition_variable has_work;
+    std::condition_variable has_done;
+    bool stop = false;
+    void work();
+
+public:
+    ThreadPoolIO(int num_threads);
+    ~ThreadPoolIO();
+    void submit(IORequest* request);
+    void wait(IORequest* request);
+    std::string name();
+};
+
+#ifdef __linux__
+class UringIO: public IOBackend{
+    int ring_fd = -1;
+    unsigned int entries = 0;
+    unsigned int pending = 0;   //requests queued in the submission ring but not submitted yet
+    unsigned int in_flight = 0; //requests submitted but not reaped
+    bool failed = false;        //io_uring_enter failed, the requests are done with blocking calls
+    //submission ring
+    void* sq_ring = NULL;
+    unsigned long sq_ring_size = 0;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    void* sqes = NULL;
+    unsigned long sqes_size = 0;
+    //completion ring
+    void* cq_ring = NULL;
+    unsigned long cq_ring_size = 0;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    void* cqes;
+    bool enter(unsigned int min_complete);
+    void fail();
+    void reap();
+
+public:
+    UringIO(unsigned int queue_depth);
+    ~UringIO();
+    bool valid();
+    void submit(IORequest* request);
+    void wait(IORequest* request);
+    std::string name();
+};
+#endif
+
+IOBackend* create_io_backend(IOBackendType type, int queue_depth);
+bool parse_io_backend(const std::string& name, IOBackendType& type);
+
+#endif /* IO_Backend_hpp */
@@ -14,148 +14,611 @@
 #include <climits>
 #include <fstream>
 #include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 /**
  utility function
  */
 
+/*
+ Order by key, then from the newest version to the oldest
+ */
 bool compareKVpair(KVpair pair1, KVpair pair2){
-    return pair1.key < pair2.key;
+    if(pair1.key != pair2.key) return pair1.key < pair2.key;
+    return pair1.seq > pair2.seq;
+}
+
+bool compareNewest(KVpair pair1, KVpair pair2){
+    return pair1.seq > pair2.seq;
+}
+
+bool compareRangeTombstone(RangeTombstone rt1, RangeTombstone rt2){
+    return rt1.low < rt2.low;
+}
+
+/*
+ Find the newest range tombstone visible at the snapshot that deletes the key
+ @return its sequence number, 0 when the key is not deleted
+ */
+unsigned long covering_seq(const std::vector<RangeTombstone>& range_tombstones, int key, unsigned long snapshot){
+    unsigned long seq = 0;
+    for(int i = 0; i < range_tombstones.size(); i++){
+        if(key >= range_tombstones[i].low && key < range_tombstones[i].high && range_tombstones[i].seq <= snapshot){
+            seq = std::max(seq, range_tombstones[i].seq);
+        }
+    }
+    return seq;
+}
+
+/*
+ Check if a version is still seen by a reader
+ @param seq the sequence number of the version
+ newer the sequence number of whatever replaces it, MAX_SEQ when nothing does
+ snapshots the sequence numbers of the live snapshots, sorted
+ @return true when the latest state or a live snapshot sees the version
+ */
+bool needed(unsigned long seq, unsigned long newer, const std::vector<unsigned long>& snapshots){
+    if(newer == MAX_SEQ) return true;
+    auto it = std::lower_bound(snapshots.begin(), snapshots.end(), seq);
+    return it != snapshots.end() && *it < newer;
+}
+
+/*
+ Sort the range tombstones and leave out the ones no reader needs
+ A tombstone inside a newer one is only needed by the snapshots between the two;
+ with drop_tombstones nothing older exists, so a tombstone is only needed to hide
+ the versions kept for the snapshots older than it
+ */
+void prune_range_tombstones(std::vector<RangeTombstone>& range_tombstones, const std::vector<unsigned long>& snapshots, bool drop_tombstones){
+    std::vector<RangeTombstone> result;
+    for(int i = 0; i < range_tombstones.size(); i++){
+        RangeTombstone& rt = range_tombstones[i];
+        bool keep = !drop_tombstones || (!snapshots.empty() && snapshots.front() < rt.seq);
+        for(int j = 0; keep && j < range_tombstones.size(); j++){
+            RangeTombstone& other = range_tombstones[j];
+            if(other.seq > rt.seq && other.low <= rt.low && other.high >= rt.high && !needed(rt.seq, other.seq, snapshots)){
+                keep = false;
+            }
+        }
+        if(keep) result.push_back(rt);
+    }
+    std::sort(result.begin(), result.end(), compareRangeTombstone);
+    range_tombstones.swap(result);
+}
+
+/*
+ Pick the versions of a key a merge keeps
+ A version is kept when the latest state or a live snapshot sees it, that is when no newer
+ version and no range tombstone of the merged runs replaces it before one of them
+ A version only an operand stands on is applied to the operand, which becomes a value
+ once it meets a value or a tombstone
+ @param versions all the versions of the key, ordered from the newest
+ range_tombstones the range tombstones of the merged runs
+ drop_tombstones when true, tombstones left as the oldest kept versions are left out too,
+ and operands with nothing under them become values
+ kept the kept versions are appended to it, from the newest
+ */
+void keep_versions(std::vector<KVpair>& versions, const std::vector<RangeTombstone>& range_tombstones, const std::vector<unsigned long>& snapshots, bool drop_tombstones, const MergeOperator* merge_operator, std::vector<KVpair>& kept){
+    unsigned long first = kept.size();
+    unsigned long newer = MAX_SEQ;
+    for(int i = 0; i < versions.size(); i++){
+        unsigned long next = newer;
+        for(int j = 0; j < range_tombstones.size(); j++){
+            const RangeTombstone& rt = range_tombstones[j];
+            if(versions[i].key >= rt.low && versions[i].key < rt.high && rt.seq > versions[i].seq && rt.seq < next){
+                next = rt.seq;
+            }
+        }
+        if(needed(versions[i].seq, next, snapshots)){
+            kept.push_back(versions[i]);
+        }else if(kept.size() > first && kept.back().operand){
+            //the version is only there for the operand above it
+            KVpair& above = kept.back();
+            bool deleted = versions[i].del || covering_seq(range_tombstones, versions[i].key, above.seq) > versions[i].seq;
+            if(!deleted) above.value = merge_operator->combine(versions[i].value, above.value);
+            above.operand = !deleted && versions[i].operand;
+        }
+        newer = versions[i].seq;
+    }
+    if(drop_tombstones && kept.size() > first) kept.back().operand = false;
+    while(drop_tombstones && kept.size() > first && kept.back().del){
+        kept.pop_back();
+    }
+}
+
+/*
+ Combine what a lookup found so far with what an older source holds for the key
+ The results are 1: found, 0: not found, -1: deleted, 2: operands found, to apply to the older versions
+ @param c the result so far, 0 or 2, value holds the operands folded so far
+ older the result of the older source, older_value its value
+ @return the result with the older source
+ */
+int apply_older(const MergeOperator* merge_operator, int c, int& value, int older, int older_value){
+    if(c == 0){
+        if(older == 1 || older == 2) value = older_value;
+        return older;
+    }
+    if(older == 0) return 2;
+    //operands on a deleted key apply to nothing
+    if(older == -1) return 1;
+    value = merge_operator->combine(older_value, value);
+    return older;
+}
+
+/*
+ Add a version met by a range query, which goes from the newest versions to the oldest:
+ the first version of a key decides, unless it is an operand, the older versions are then applied to it
+ @param deleted whether a range tombstone deletes the version
+ @return whether the key is decided, its older versions don't matter
+ */
+bool add_to_range(std::unordered_map<int, KVpair>& res, const KVpair& kv, bool deleted, const MergeOperator* merge_operator){
+    auto it = res.find(kv.key);
+    if(it == res.end()){
+        KVpair& entry = res[kv.key];
+        entry = kv;
+        if(deleted){
+            entry.del = true;
+            entry.operand = false;
+        }
+        return !entry.operand;
+    }
+    KVpair& entry = it->second;
+    if(!entry.operand) return true;
+    if(deleted || kv.del){
+        entry.operand = false;
+        return true;
+    }
+    entry.value = merge_operator->combine(kv.value, entry.value);
+    entry.operand = kv.operand;
+    return !entry.operand;
+}
+
+/**
+ Options
+ */
+
+/**
+ A level holds as many runs as the size ratio before it is merged
+ */
+unsigned int Options::num_runs() const{
+    return size_ratio;
+}
+
+/**
+ Levels from this rank on have no bloom filter, their false positive rate would be above fp_threshold
+ */
+int Options::level_with_bf() const{
+    return (int)log(fp_threshold/fprate0)/log(size_ratio);
+}
+
+/**
+ Here use the formula from the paper to calculate the fp rate for each level
+ */
+double Options::fprate(int rank) const{
+    return fprate0*pow(size_ratio, rank);
+}
+
+FilterType Options::filter_type(int rank) const{
+    if(filter_types.empty()) return FILTER_BLOOM;
+    return filter_types[std::min((unsigned long)rank, filter_types.size()-1)];
+}
+
+/**
+ @return the path of a file in the data directory
+ */
+std::string Options::path(const std::string& file) const{
+    if(data_dir.empty()) return file;
+    return data_dir + "/" + file;
+}
+
+/**
+ @return the path of a run file of the level
+ */
+std::string Options::level_path(int rank, const std::string& file) const{
+    if(level_dirs.empty()) return path(file);
+    const std::string& dir = level_dirs[std::min((unsigned long)rank, level_dirs.size()-1)];
+    if(dir.empty()) return path(file);
+    return dir + "/" + file;
 }
 
 /*
- Create a bloom filter for the run
- @param run the array of the KVpairs in a run
- numBits the filter size in bits:m
- numHashes number of hash functions in a filter:k
- @return the pointer to the bloom filter
+ Create the filter of a run once the run is written, sized for its exact number of keys
+ @param keys the distinct keys of the run
+ falPosRate the false positive rate of the filter
+ type the kind of filter
+ @return the pointer to the filter
  */
-BloomFilter* create_bloom_filter(KVpair* run, unsigned long int numEntries, double falPosRate){
-    BloomFilter* filter = new BloomFilter(numEntries, falPosRate);
-    for(int i = 0; i < numEntries; i++){
-        filter->add(run[i].key);
+Filter* create_filter(const std::vector<int>& keys, double falPosRate, FilterType type){
+    if(type == FILTER_XOR) return new XorFilter(keys, falPosRate);
+    BloomFilter* filter = new BloomFilter(keys.size(), falPosRate);
+    for(int i = 0; i < keys.size(); i++){
+        filter->add(keys[i]);
     }
     return filter;
 };
 
 /*
- Create an array of fence pointer for the run
- Called only when the size of the run is greater than parameters::KVPAIRPERPAGE
+ Read back a filter written by Filter::write
+ @return NULL when the input ends early or holds no filter
+ */
+Filter* read_filter(std::istream& in){
+    uint8_t format;
+    if(!in.read((char*)&format, sizeof(format))) return NULL;
+    if(format == FORMAT_BLOOM) return BloomFilter::read(in);
+    if(format == FORMAT_XOR) return XorFilter::read(in);
+    return NULL;
+}
+
+/*
+ Memory a filter needs per key for the false positive rate
+ bloom filter: ln(1/p)/ln^2(2), xor filter: 1.23*ceil(log2(1/p))
+ */
+double filter_bits_per_key(FilterType type, double falPosRate){
+    if(type == FILTER_XOR) return 1.23*XorFilter::fingerprint_bits(falPosRate);
+    return log(1/falPosRate)/(log(2)*log(2));
+}
+
+/*
+ The distinct keys of a sorted array of KVpairs
+ */
+std::vector<int> distinct_keys(KVpair* run, unsigned long int size){
+    std::vector<int> keys;
+    for(unsigned long int i = 0; i < size; i++){
+        if(keys.empty() || keys.back() != run[i].key) keys.push_back(run[i].key);
+    }
+    return keys;
+}
+
+/*
+ Create the fence index of the run
+ Called only when the size of the run is greater than the page size
  @param run is the array of the KVpairs in a run
  size is the length of the run
- num_pointers stores the number of fence pointers in the array
- @return the pointer to the array
+ page_size is the number of KVpairs in a page
+ block_pages is the number of pages in a block of the index
+ @return the pointer to the index
  */
-FencePointer* create_fence_pointer(KVpair* run, unsigned long int size, int& num_pointers){
-    num_pointers = (int)ceil((double)size/(double)parameters::KVPAIRPERPAGE);
-    FencePointer* fparray = new FencePointer[num_pointers];
-    for(int i = 0; i < num_pointers; i++){
-        fparray[i].min = run[i*parameters::KVPAIRPERPAGE].key;
-        fparray[i].max = run[std::min((i+1)*parameters::KVPAIRPERPAGE-1, size-1)].key;
+FenceIndex* create_fence_index(KVpair* run, unsigned long int size, unsigned long int page_size, unsigned int block_pages){
+    std::vector<int> mins;
+    for(unsigned long int i = 0; i < size; i += page_size){
+        mins.push_back(run[i].key);
     }
-    return fparray;
+    return new FenceIndex(mins, run[size-1].key, block_pages);
+}
+
+/*
+ Count an entry of a page in its summary
+ @param repeated_key whether the entry before it, maybe on the previous page, has the same key
+ */
+void add_to_summary(PageSummary& summary, const KVpair& kv, bool repeated_key){
+    summary.min_seq = std::min(summary.min_seq, kv.seq);
+    summary.max_seq = std::max(summary.max_seq, kv.seq);
+    summary.last_key = kv.key;
+    if(kv.del || kv.operand || repeated_key){
+        summary.clean = false;
+        return;
+    }
+    summary.count += 1;
+    summary.sum += kv.value;
+    summary.min = std::min(summary.min, kv.value);
+    summary.max = std::max(summary.max, kv.value);
+}
+
+/*
+ Create the summaries of the pages of a run, one per page
+ */
+PageSummary* create_page_summaries(KVpair* run, unsigned long int size, unsigned long int page_size, int num_pages){
+    PageSummary* summaries = new PageSummary[num_pages];
+    for(unsigned long int i = 0; i < size; i++){
+        add_to_summary(summaries[i/page_size], run[i], i > 0 && run[i-1].key == run[i].key);
+    }
+    return summaries;
+}
+
+void Aggregate::add(int value){
+    count += 1;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+}
+
+void Aggregate::add(const PageSummary& summary){
+    count += summary.count;
+    sum += summary.sum;
+    min = std::min(min, summary.min);
+    max = std::max(max, summary.max);
+    summarized_pages += 1;
 }
 
 /** Buffer
  */
 
+/**
+ The entries are allocated as the buffer fills up, so that a buffer that sees few writes
+ holds little memory
+ */
+Buffer::Buffer(unsigned int capacity){
+    this->capacity = capacity;
+}
+
+/**
+ Change the capacity of the buffer, only when it is empty
+ */
+void Buffer::set_capacity(unsigned int new_capacity){
+    if(size > 0 || !range_tombstones.empty()) return;
+    capacity = new_capacity;
+    if(data.size() > capacity) release();
+}
+
+/**
+ Give back the memory of the entries, only when the buffer is empty
+ */
+void Buffer::release(){
+    if(size > 0 || !range_tombstones.empty()) return;
+    std::vector<KVpair>().swap(data);
+    std::vector<RangeTombstone>().swap(range_tombstones);
+}
+
+/**
+ @return the bytes held by the entries and the range tombstones written so far
+ */
+unsigned long Buffer::size_in_bytes(){
+    return size*sizeof(KVpair) + range_tombstones.size()*sizeof(RangeTombstone);
+}
+
+/**
+ @return the bytes the entries and the range tombstones hold, the room they grew to included
+ */
+unsigned long Buffer::allocated_bytes(){
+    return data.capacity()*sizeof(KVpair) + range_tombstones.capacity()*sizeof(RangeTombstone);
+}
+
+
+/**
+ Add a version of the key to the buffer
+ The newest version of the key is replaced in place, unless a live snapshot still sees it
+ @param newest where the newest version of the key is in the buffer, -1 when it has none
+ @return when true, the buffer has reached capacity
+ */
+bool add_version(Buffer& buffer, int newest, int key, int value, bool del, bool operand, unsigned long seq, const std::vector<unsigned long>& snapshots){
+    if(newest >= 0 && !needed(buffer.data[newest].seq, seq, snapshots)){
+        buffer.data[newest].value = value;
+        buffer.data[newest].del = del;
+        buffer.data[newest].operand = operand;
+        buffer.data[newest].seq = seq;
+        return false;
+    }
+    if(buffer.size == buffer.data.size()){
+        buffer.data.resize(std::max(buffer.size + 1, std::min(buffer.capacity, 2*buffer.size + 64)));
+    }
+    buffer.data[buffer.size].key = key;
+    buffer.data[buffer.size].value = value;
+    buffer.data[buffer.size].del = del;
+    buffer.data[buffer.size].operand = operand;
+    buffer.data[buffer.size].seq = seq;
+    buffer.size += 1;
+    return buffer.size + buffer.range_tombstones.size() >= buffer.capacity;
+}
+
+/**
+ @return where the newest version of the key is in the buffer, -1 when it has none
+ */
+int newest_version(Buffer& buffer, int key){
+    int i = buffer.size-1;
+    while(i >= 0 && buffer.data[i].key != key) i--;
+    return i;
+}
+
+bool add_version(Buffer& buffer, int key, int value, bool del, bool operand, unsigned long seq, const std::vector<unsigned long>& snapshots){
+    return add_version(buffer, newest_version(buffer, key), key, value, del, operand, seq, snapshots);
+}
+
+/**
+ Apply an operand of the merge operator to the newest version of the key in the buffer
+ @param i where the newest version of the key is in the buffer, -1 when it has none
+ */
+bool merge_version(Buffer& buffer, int i, int key, int operand, unsigned long seq, const MergeOperator* merge_operator, const std::vector<unsigned long>& snapshots){
+    KVpair* data = buffer.data.data();
+    unsigned long tombstone_seq = covering_seq(buffer.range_tombstones, key, MAX_SEQ);
+    if(i < 0 || data[i].seq < tombstone_seq){
+        //the older versions are in the tree, unless a range tombstone deleted them
+        return add_version(buffer, i, key, operand, false, tombstone_seq == 0, seq, snapshots);
+    }
+    if(data[i].operand && needed(data[i].seq, seq, snapshots)){
+        //a snapshot sees the operand under it, the new one stays an operand over it
+        return add_version(buffer, i, key, operand, false, true, seq, snapshots);
+    }
+    if(data[i].del) return add_version(buffer, i, key, operand, false, false, seq, snapshots);
+    return add_version(buffer, i, key, merge_operator->combine(data[i].value, operand), false, data[i].operand, seq, snapshots);
+}
 
 /**
  Put the value associated with the key in the buffer
  @param
  key the key to insert
  value the value to insert
+ seq the sequence number of the write
+ snapshots the sequence numbers of the live snapshots, sorted
  @return when true, the buffer has reached capacity
  */
-bool Buffer::put(int key, int value){
-    bool exist = false;
-    for(int i = 0; i < size; i++){
-        if(data[i].key == key){
-            data[i].value = value;
-            data[i].del = false;
-            exist = true;
-        }
-    }
-    if(!exist){
-        data[size].key = key;
-        data[size].value = value;
-        data[size].del = false;
-        size += 1;
-        if(size >= parameters::BUFFER_CAPACITY){
-            return true;
-        }
-    }
-    return false;
+bool Buffer::put(int key, int value, unsigned long seq, const std::vector<unsigned long>& snapshots){
+    return add_version(*this, key, value, false, false, seq, snapshots);
 };
 
+/**
+ Add an operand of the merge operator for the key
+ It is applied to the newest version of the key in the buffer, which it replaces unless a live
+ snapshot sees it; without one, it stays an operand for the versions in the tree
+ @return when true, the buffer has reached capacity
+ */
+bool Buffer::merge(int key, int operand, unsigned long seq, const MergeOperator* merge_operator, const std::vector<unsigned long>& snapshots){
+    return merge_version(*this, newest_version(*this, key), key, operand, seq, merge_operator, snapshots);
+}
 
 /**
 Get the value associated with the key in the buffer
  
  @param key the key to delete
  value: address to store the return value
+ snapshot: only the versions up to this sequence number are seen
  @return 1: found
  0: not found
  -1: (latest version)deleted, which means no need to go on searching
+ 2: operands found, value holds them folded, they apply to the versions in the tree
  */
-int Buffer::get(int key, int& value){
-    for(int i = size-1; i >= 0; i--){
-        if(data[i].key == key){
-            if(data[i].del){
-                return -1;
-            }else{
-                value = data[i].value;
-                return 1;
-            }
-        }
+int Buffer::get(int key, int& value, unsigned long snapshot, const MergeOperator* merge_operator){
+    //the versions of a key are in the order they were written
+    unsigned long tombstone_seq = covering_seq(range_tombstones, key, snapshot);
+    int c = 0;
+    for(int i = size-1; i >= 0 && (c == 0 || c == 2); i--){
+        if(data[i].key != key || data[i].seq > snapshot) continue;
+        //everything in the tree is older than the range tombstones of the buffer
+        int found = data[i].del || data[i].seq < tombstone_seq ? -1 : (data[i].operand ? 2 : 1);
+        c = apply_older(merge_operator, c, value, found, data[i].value);
     }
-    return 0;
+    if(tombstone_seq > 0 && c == 0) return -1;
+    //the operands apply to nothing once the range tombstone deleted the versions in the tree
+    if(tombstone_seq > 0 && c == 2) return 1;
+    return c;
 };
 
 /**
  Delete the value associated with the key in the buffer
  
  @param key the key to delete
+ seq the sequence number of the write
  @return when true, the buffer has reached capacity
  */
-bool Buffer::del(int key){
+bool Buffer::del(int key, unsigned long seq, const std::vector<unsigned long>& snapshots){
+    return add_version(*this, key, 0, true, false, seq, snapshots);
+};
+
+/**
+ Delete all the keys in [low, high)
+ Entries in the buffer within the range are removed unless a live snapshot sees them,
+ a range tombstone is kept for the older versions in the tree
+ 
+ @param low the smallest key to delete
+ high the first key after the range
+ seq the sequence number of the write
+ @return when true, the buffer has reached capacity
+ */
+bool Buffer::del_range(int low, int high, unsigned long seq, const std::vector<unsigned long>& snapshots){
+    unsigned int kept = 0;
     for(int i = 0; i < size; i++){
-        if(data[i].key == key){
-            data[i].del = true;
-            return false;
+        if(data[i].key < low || data[i].key >= high || needed(data[i].seq, seq, snapshots)){
+            data[kept] = data[i];
+            kept += 1;
         }
     }
-    //when not found in the buffer
-    data[size].key = key;
-    data[size].value = 0;
-    data[size].del = true;
-    size += 1;
-    if(size >= parameters::BUFFER_CAPACITY) return true;
+    size = kept;
+    RangeTombstone rt;
+    rt.low = low;
+    rt.high = high;
+    rt.seq = seq;
+    range_tombstones.push_back(rt);
+    prune_range_tombstones(range_tombstones, snapshots, false);
+    if(size + range_tombstones.size() >= capacity) return true;
     return false;
 };
 
-void Buffer::range(int low, int high, std::unordered_map<int, KVpair>& res){
+/**
+ Apply the writes of a batch with a single sequence number, in one pass over the buffer
+ The range deletes go first, a point write of the batch is never under one of them
+ 
+ @param points one write per key, sorted by key, as WriteBatch::resolve leaves them
+ range_deletes the range deletes of the batch
+ seq the sequence number of the batch
+ @return when true, the buffer has reached capacity
+ */
+bool Buffer::write(const std::vector<KVpair>& points, const std::vector<RangeTombstone>& range_deletes, unsigned long seq, const MergeOperator* merge_operator, const std::vector<unsigned long>& snapshots){
+    if(!range_deletes.empty()){
+        std::vector<RangeTombstone> batch_tombstones(range_deletes);
+        for(int i = 0; i < batch_tombstones.size(); i++){
+            batch_tombstones[i].seq = seq;
+        }
+        unsigned int kept = 0;
+        for(int i = 0; i < size; i++){
+            if(covering_seq(batch_tombstones, data[i].key, seq) == 0 || needed(data[i].seq, seq, snapshots)){
+                data[kept] = data[i];
+                kept += 1;
+            }
+        }
+        size = kept;
+        range_tombstones.insert(range_tombstones.end(), batch_tombstones.begin(), batch_tombstones.end());
+        prune_range_tombstones(range_tombstones, snapshots, false);
+    }
+    //the newest version of each key of the batch, the later versions of a key come later in the buffer
+    std::vector<int> newest(points.size(), -1);
     for(int i = 0; i < size; i++){
+        auto it = std::lower_bound(points.begin(), points.end(), data[i].key, [](const KVpair& kv, int key){
+            return kv.key < key;
+        });
+        if(it != points.end() && it->key == data[i].key) newest[it - points.begin()] = i;
+    }
+    for(int j = 0; j < points.size(); j++){
+        const KVpair& kv = points[j];
+        if(kv.operand){
+            merge_version(*this, newest[j], kv.key, kv.value, seq, merge_operator, snapshots);
+        }else{
+            add_version(*this, newest[j], kv.key, kv.value, kv.del, false, seq, snapshots);
+        }
+    }
+    return size + range_tombstones.size() >= capacity;
+}
+
+/**
+ Add the entries within the range to the result
+ @param snapshot only the versions up to this sequence number are seen
+ range_deleted collects the range tombstones that hide the older versions
+ */
+void Buffer::range(int low, int high, unsigned long snapshot, const MergeOperator* merge_operator, std::unordered_map<int, KVpair>& res, std::vector<RangeTombstone>& range_deleted){
+    for(int i = size-1; i >= 0; i--){
         int key = data[i].key;
-        if(key < high && key >= low){
-            res[key] = data[i];
+        if(key < high && key >= low && data[i].seq <= snapshot){
+            add_to_range(res, data[i], covering_seq(range_tombstones, key, snapshot) > data[i].seq, merge_operator);
+        }
+    }
+    for(int i = 0; i < range_tombstones.size(); i++){
+        if(range_tombstones[i].low < high && range_tombstones[i].high > low && range_tombstones[i].seq <= snapshot){
+            range_deleted.push_back(range_tombstones[i]);
         }
     }
 }
 
 void Buffer::sort(){
-    std::sort(data, data+parameters::BUFFER_CAPACITY, compareKVpair);
+    std::sort(data.begin(), data.begin()+size, compareKVpair);
 };
 
+/**
+ Sort the buffer and leave out the versions no reader needs anymore,
+ snapshots may have been released since they were written
+ */
+void Buffer::compact(const std::vector<unsigned long>& snapshots, const MergeOperator* merge_operator){
+    sort();
+    std::vector<KVpair> kept;
+    std::vector<KVpair> versions;
+    for(int i = 0; i < size; i++){
+        versions.push_back(data[i]);
+        if(i + 1 == size || data[i+1].key != data[i].key){
+            keep_versions(versions, range_tombstones, snapshots, false, merge_operator, kept);
+            versions.clear();
+        }
+    }
+    std::copy(kept.begin(), kept.end(), data.begin());
+    size = kept.size();
+    prune_range_tombstones(range_tombstones, snapshots, false);
+}
+
 /**
  Layer
  */
 
 
-Layer::Layer(){
-    for(int i = 0; i < parameters::NUM_RUNS; i++){
-        filters[i] = NULL;
-    }
+Layer::Layer(const Options* opts){
+    options = opts;
 }
 
 
@@ -170,25 +633,48 @@ void Layer::set_rank(int r){
  @return when true, the first layer has reached its limit
  */
 bool Layer::add_run_from_buffer(Buffer &buffer){
-    //Bloom filter
-    filters[current_run] = create_bloom_filter(buffer.data, parameters::BUFFER_CAPACITY, parameters::FPRATE0);
-    //Fence pointer
-    if(parameters::BUFFER_CAPACITY > parameters::KVPAIRPERPAGE){
-        int numPointers = 0;
-        pointers[current_run] = create_fence_pointer(buffer.data, parameters::BUFFER_CAPACITY, numPointers);
-        pointer_size[current_run] = numPointers;
+    Run run;
+    //Filter
+    if(buffer.size > 0){
+        TraceSpan span(tracer, "build filter", "build");
+        span.arg("level", rank);
+        span.arg("entries", buffer.size);
+        run.filter = create_filter(distinct_keys(buffer.data.data(), buffer.size), options->fprate(rank), options->filter_type(rank));
+    }
+    //Fence index
+    if(buffer.size > options->kvpair_per_page){
+        TraceSpan span(tracer, "build fence index", "build");
+        span.arg("level", rank);
+        span.arg("entries", buffer.size);
+        run.index = create_fence_index(buffer.data.data(), buffer.size, options->kvpair_per_page, options->fence_block_pages);
+        if(options->page_summaries){
+            run.summaries = create_page_summaries(buffer.data.data(), buffer.size, options->kvpair_per_page, run.index->num_pages());
+        }
     }
     //write to file
-    std::string name = get_name(current_run);
-    std::ofstream run(name, std::ios::binary);
-    runs[current_run] = name;
-    run.write((char*)buffer.data, parameters::BUFFER_CAPACITY*sizeof(KVpair));
-    run_size[current_run] = parameters::BUFFER_CAPACITY;
-    current_run++;
-    run.close();
+    run.name = get_name(runs.size());
+    if(rate_limiter != NULL) rate_limiter->request(buffer.size*sizeof(KVpair), PRIORITY_FLUSH);
+    //a file left under the name can be linked from a checkpoint, it is replaced, not overwritten
+    remove(run.name.c_str());
+    std::ofstream file(run.name, std::ios::binary);
+    file.write((char*)buffer.data.data(), buffer.size*sizeof(KVpair));
+    file.close();
+    if(run.index != NULL) run.index->write(run.name);
+    run.size = buffer.size;
+    if(buffer.size > 0){
+        run.min_key = buffer.data[0].key;
+        run.max_key = buffer.data[buffer.size-1].key;
+    }
+    for(int i = 0; i < buffer.size; i++){
+        if(buffer.data[i].del) run.tombstones += 1;
+    }
+    run.range_tombstones.swap(buffer.range_tombstones);
+    place_index(run);
+    runs.push_back(run);
     //TODO: change the setter on buffer
     buffer.size = 0;
-    return current_run == parameters::NUM_RUNS;
+    buffer.range_tombstones.clear();
+    return full();
 };
 
 
@@ -196,26 +682,107 @@ bool Layer::add_run_from_buffer(Buffer &buffer){
  Reset the layer, free memory, delete file
  */
 void Layer::reset(){
-    current_run = 0;
-    for(int i = 0; i < parameters::NUM_RUNS; i++){
-        run_size[i] = 0;
-        pointer_size[i] = 0;
-        delete filters[i];
-        if(pointers[i] != NULL){
-            delete [] pointers[i];
-            pointers[i] = NULL;
-        }
-        filters[i] = NULL;
-        runs[i].clear();
-        std::string name = get_name(i);
-        if(remove(name.c_str()) != 0){
+    close_runs();
+    for(int i = 0; i < runs.size(); i++){
+        delete runs[i].filter;
+        delete runs[i].index;
+        delete [] runs[i].summaries;
+        if(remove(runs[i].name.c_str()) != 0){
             std::cout<<"Error deleting the file"<<std::endl;
         };
     }
+    runs.clear();
 };
 
+/**
+ Free the filters, indexes and summaries of the runs when the tree goes away,
+ the run files stay
+ */
+void Layer::release(){
+    close_runs();
+    for(int i = 0; i < runs.size(); i++){
+        delete runs[i].filter;
+        delete runs[i].index;
+        delete [] runs[i].summaries;
+    }
+    runs.clear();
+}
+
+/**
+ @return the descriptor of a run file for lookups, opened on the first use and kept,
+ -1 when the file can't be opened
+ */
+int Layer::run_fd(int index){
+    Run& run = runs[index];
+    if(run.fd < 0) run.fd = open(run.name.c_str(), O_RDONLY);
+    return run.fd;
+}
+
+/**
+ Close the files opened for lookups, the runs are going away
+ */
+void Layer::close_runs(){
+    for(int i = 0; i < runs.size(); i++){
+        if(runs[i].fd >= 0) close(runs[i].fd);
+        runs[i].fd = -1;
+    }
+}
+
 std::string Layer::get_name(int nthRun){
-    return "run_" + std::to_string(rank) + "_" + std::to_string(nthRun);
+    return options->level_path(rank, "run_" + std::to_string(rank) + "_" + std::to_string(nthRun));
+}
+
+/**
+ @return the file a merge into the layer is written to before it is renamed,
+ in the directory of the layer, so the run is moved there by the merge
+ */
+std::string Layer::get_temp_name(){
+    return options->level_path(rank, "run_" + std::to_string(rank) + "_temp");
+}
+
+/**
+ @return the number of runs of the layer, each segment of a concatenated run on its own
+ */
+unsigned int Layer::num_runs(){
+    return runs.size();
+}
+
+const Run& Layer::get_run(int i){
+    return runs.at(i);
+}
+
+/**
+ @return true when the layer holds as many runs as allowed by the options,
+ the limit can change between compactions
+ */
+bool Layer::full(){
+    return num_sorted_runs() >= options->num_runs();
+}
+
+/**
+ @return the number of runs of the layer, the segments of a concatenated run count once
+ */
+unsigned int Layer::num_sorted_runs(){
+    unsigned int count = 0;
+    for(int i = 0; i < runs.size(); i++){
+        if(!runs[i].continued) count += 1;
+    }
+    return count;
+}
+
+/**
+ The fraction of entries in the layer that are tombstones
+ @return 0 when the layer is empty
+ */
+double Layer::tombstone_ratio(){
+    unsigned long total = 0;
+    unsigned long dead = 0;
+    for(int i = 0; i < runs.size(); i++){
+        total += runs[i].size;
+        dead += runs[i].tombstones;
+    }
+    if(total == 0) return 0;
+    return (double)dead/(double)total;
 }
 
 /**
@@ -223,219 +790,731 @@ std::string Layer::get_name(int nthRun){
  NOTE: Can't use heap to do the merge sort because we need to maintain the order of runs to know
  which are the newest values
  Use temp vector to store the merged result then write to file: minimize number of I/O
- @param size stores the size of the resulting run
- @return the name of the file of the new run
+ @param new_run stores the resulting run, its name is the file to write,
+ run_<rank>_temp of this layer when empty
+ drop_tombstones when true, nothing older than this level exists, so tombstones
+ (and the values they shadow) are left out of the resulting run
+ snapshots the sequence numbers of the live snapshots, sorted, the versions they see are kept
+ @return false when the resulting run is empty
  */
-std::string Layer::merge(unsigned long &size, BloomFilter*& bf, FencePointer*& fp, int &num_pointers){
+bool Layer::merge(Run& new_run, bool drop_tombstones, const std::vector<unsigned long>& snapshots){
     //read files and set index
-    KVpair *read_runs[parameters::NUM_RUNS];
-    int* indexes = new int[parameters::NUM_RUNS];
-    for(int i = 0; i < parameters::NUM_RUNS; i++){
+    int num = runs.size();
+    std::vector<KVpair*> read_runs(num);
+    std::vector<int> indexes(num);
+    int ct = num; //the count of active arrays
+    for(int i = 0; i < num; i++){
         indexes[i] = 0;
-        std::ifstream inStream(get_name(i), std::ios::binary);
-        read_runs[i] = new KVpair[run_size[i]];
-        inStream.read((char*)read_runs[i], run_size[i]*sizeof(KVpair));
+        if(runs[i].size == 0){
+            //a run can hold nothing but range tombstones
+            indexes[i] = -1;
+            ct -= 1;
+        }
+        std::ifstream inStream(runs[i].name, std::ios::binary);
+        read_runs[i] = new KVpair[runs[i].size];
+        inStream.read((char*)read_runs[i], runs[i].size*sizeof(KVpair));
         inStream.close();
     }
+    std::vector<RangeTombstone> range_tombstones;
+    for(int i = 0; i < num; i++){
+        range_tombstones.insert(range_tombstones.end(), runs[i].range_tombstones.begin(), runs[i].range_tombstones.end());
+    }
     //perform merge
     std::vector<KVpair> run_buffer;
-    int ct = parameters::NUM_RUNS; //the count of active arrays
+    std::vector<KVpair> versions;
     int min;
     while(ct > 0){
-        std::vector<int> min_indexes;
         min = INT_MAX;
-        //there is no duplicate inside each run, scan from the old runs to the new runs
-        for(int i = 0; i < parameters::NUM_RUNS; i++){
-            if(indexes[i] >= 0){
-                if(read_runs[i][indexes[i]].key < min){
-                    min = read_runs[i][indexes[i]].key;
-                    min_indexes.clear();
-                    min_indexes.push_back(i);
-                }else if (read_runs[i][indexes[i]].key == min){
-                    min_indexes.push_back(i);
-                }
+        for(int i = 0; i < num; i++){
+            if(indexes[i] >= 0 && read_runs[i][indexes[i]].key < min){
+                min = read_runs[i][indexes[i]].key;
             }
         }
-        int min_index = min_indexes.back();
-        run_buffer.push_back(read_runs[min_index][indexes[min_index]]);
-        for(int i = 0; i < min_indexes.size(); i++){
-            int cur_index = min_indexes.at(i);
-            indexes[cur_index] += 1;
-            if(indexes[cur_index] >= run_size[cur_index]){
-                //set index to -1 when the the last element of the array is used
-                indexes[cur_index] = -1;
-                ct -= 1;
+        //gather every version of the key, a run can hold several
+        versions.clear();
+        for(int i = 0; i < num; i++){
+            while(indexes[i] >= 0 && read_runs[i][indexes[i]].key == min){
+                versions.push_back(read_runs[i][indexes[i]]);
+                indexes[i] += 1;
+                if(indexes[i] >= runs[i].size){
+                    //set index to -1 when the the last element of the array is used
+                    indexes[i] = -1;
+                    ct -= 1;
+                }
             }
         }
+        std::sort(versions.begin(), versions.end(), compareNewest);
+        keep_versions(versions, range_tombstones, snapshots, drop_tombstones, options->merge_operator, run_buffer);
     }
     //free space for intermediate storage
-    for(int i = 0; i < parameters::NUM_RUNS; i++){
+    for(int i = 0; i < num; i++){
         delete [] read_runs[i];
     }
-    //set the new size, create array
-    size = run_buffer.size();
-    KVpair* new_run = new KVpair[size];
+    new_run.tombstones = 0;
+    for(int i = 0; i < run_buffer.size(); i++){
+        if(run_buffer[i].del) new_run.tombstones += 1;
+    }
+    //the range tombstones still hide older versions in the following levels
+    prune_range_tombstones(range_tombstones, snapshots, drop_tombstones);
+    new_run.range_tombstones.swap(range_tombstones);
+    //set the new size
+    unsigned long size = run_buffer.size();
+    new_run.size = size;
+    if(size > 0){
+        new_run.min_key = run_buffer.front().key;
+        new_run.max_key = run_buffer.back().key;
+    }
+    if(size == 0 && new_run.range_tombstones.empty()){
+        //every entry was a dropped tombstone
+        reset();
+        return false;
+    }
     //write to file
-    std::string name = "run_" + std::to_string(rank) + "_temp";
-    std::ofstream new_file(name, std::ios::binary);
-    std::copy(run_buffer.begin(), run_buffer.end(), new_run);
-    new_file.write((char*)new_run, size*sizeof(KVpair));
+    if(new_run.name.empty()) new_run.name = get_temp_name();
+    if(rate_limiter != NULL) rate_limiter->request(size*sizeof(KVpair), PRIORITY_COMPACTION);
+    std::ofstream new_file(new_run.name, std::ios::binary);
+    new_file.write((char*)run_buffer.data(), size*sizeof(KVpair));
     new_file.close();
-    //create bloom filter TODO: change to create_bloom_filter function!!
-    //Here use the formula from the paper to calculate the fp rate for each level
-    double fprate = parameters::FPRATE0*pow(parameters::SIZE_RATIO, rank);
-    if(rank < parameters::LEVELWITHBF-1){
-        bf = new BloomFilter(size, fprate);
-        for(int i = 0; i < size; i++){
-            bf->add(new_run[i].key);
-        }
+    //create filter
+    if(rank < options->level_with_bf()-1 && size > 0){
+        TraceSpan span(tracer, "build filter", "build");
+        span.arg("level", rank);
+        span.arg("entries", size);
+        new_run.filter = create_filter(distinct_keys(run_buffer.data(), size), options->fprate(rank), options->filter_type(rank));
     }
     //create fence pointer
-    if(size > parameters::KVPAIRPERPAGE){
-        fp = create_fence_pointer(new_run, size, num_pointers);
+    if(size > options->kvpair_per_page){
+        TraceSpan span(tracer, "build fence index", "build");
+        span.arg("level", rank);
+        span.arg("entries", size);
+        new_run.index = create_fence_index(run_buffer.data(), size, options->kvpair_per_page, options->fence_block_pages);
+        new_run.index->write(new_run.name);
+        if(options->page_summaries){
+            new_run.summaries = create_page_summaries(run_buffer.data(), size, options->kvpair_per_page, new_run.index->num_pages());
+        }
     }
     //reset the layer, free the dynamic memory
     reset();
-    delete[] indexes;
-    delete [] new_run;
-    
-    return name;
+    return true;
 };
 
 /**
- Merge all runs to one run in this level
+ RunReader
+ Reads a run in chunks, while one chunk is being merged, the next one is read in the background
+ */
+RunReader::RunReader(IOBackend* backend, std::string file, unsigned long run_size, unsigned long chunk){
+    io = backend;
+    size = run_size;
+    chunk_size = chunk;
+    fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0) std::cout<<"Error opening the file"<<std::endl;
+    for(int i = 0; i < 2; i++){
+        chunks[i] = new KVpair[chunk_size];
+        issued[i] = false;
+    }
+    request(0);
+    current = 1;
+    length = 0;
+    position = 0;
+    next();
+}
+
+RunReader::~RunReader(){
+    for(int i = 0; i < 2; i++){
+        if(issued[i]) io->wait(&requests[i]);
+        delete [] chunks[i];
+    }
+    if(fd >= 0) close(fd);
+}
+
+/**
+ Start reading the next part of the run into a chunk
+ */
+void RunReader::request(int i){
+    issued[i] = false;
+    if(requested >= size) return;
+    unsigned long n = std::min(chunk_size, size - requested);
+    init_request(requests[i], fd, false, requested*sizeof(KVpair), n*sizeof(KVpair), (char*)chunks[i]);
+    io->submit(&requests[i]);
+    requested += n;
+    issued[i] = true;
+}
+
+bool RunReader::valid(){
+    return position < length;
+}
+
+KVpair& RunReader::peek(){
+    return chunks[current][position];
+}
+
+/**
+ Move to the next KVpair, switch to the other chunk when the current one is used up
+ */
+void RunReader::next(){
+    position += 1;
+    if(position < length) return;
+    int other = 1 - current;
+    length = 0;
+    position = 0;
+    if(!issued[other]) return;
+    io->wait(&requests[other]);
+    issued[other] = false;
+    if(requests[other].result > 0) length = requests[other].result/sizeof(KVpair);
+    //refill the chunk that was just used up
+    request(current);
+    current = other;
+}
+
+/**
+ RunWriter
+ Collects KVpairs in one chunk while the other chunk is being written
+ */
+/**
+ @param rate_limiter when not NULL, every chunk waits for it as a compaction before it is written
+ */
+RunWriter::RunWriter(IOBackend* backend, std::string file, unsigned long chunk, RateLimiter* rate_limiter){
+    io = backend;
+    limiter = rate_limiter;
+    chunk_size = chunk;
+    fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) std::cout<<"Error opening the file"<<std::endl;
+    for(int i = 0; i < 2; i++){
+        chunks[i] = new KVpair[chunk_size];
+        pending[i] = false;
+    }
+}
+
+RunWriter::~RunWriter(){
+    finish();
+    for(int i = 0; i < 2; i++){
+        delete [] chunks[i];
+    }
+}
+
+void RunWriter::add(const KVpair& kv){
+    chunks[current][length] = kv;
+    length += 1;
+    if(length == chunk_size) submit();
+}
+
+/**
+ Start writing the current chunk, then wait until the other chunk can be reused
+ */
+void RunWriter::submit(){
+    if(length == 0) return;
+    if(limiter != NULL) limiter->request(length*sizeof(KVpair), PRIORITY_COMPACTION);
+    init_request(requests[current], fd, true, offset, length*sizeof(KVpair), (char*)chunks[current]);
+    io->submit(&requests[current]);
+    pending[current] = true;
+    offset += length*sizeof(KVpair);
+    current = 1 - current;
+    length = 0;
+    wait(current);
+}
+
+void RunWriter::wait(int i){
+    if(!pending[i]) return;
+    io->wait(&requests[i]);
+    pending[i] = false;
+    if(requests[i].result != requests[i].length) std::cout<<"Error writing the file"<<std::endl;
+}
+
+/**
+ Write what is left and close the file
+ */
+void RunWriter::finish(){
+    if(fd < 0) return;
+    submit();
+    wait(0);
+    wait(1);
+    close(fd);
+    fd = -1;
+}
+
+/**
+ RunBuilder
+ @param run the run to build, its name is the file to write
+ */
+/**
+ @param write_chunk KVpairs written behind at a time, 0 for the write_behind_pages of the options
+ filter_keys when false, the run gets no filter and its keys aren't kept for one
+ */
+RunBuilder::RunBuilder(IOBackend* io, Run& run, const Options* opts, RateLimiter* rate_limiter, unsigned long write_chunk, bool filter_keys): writer(io, run.name, write_chunk > 0 ? write_chunk : opts->write_behind_pages*opts->kvpair_per_page, rate_limiter), run(run){
+    options = opts;
+    this->filter_keys = filter_keys;
+    run.size = 0;
+    run.tombstones = 0;
+}
+
+void RunBuilder::add(const KVpair& kv){
+    writer.add(kv);
+    if(kv.del) run.tombstones += 1;
+    bool repeated_key = run.size > 0 && run.max_key == kv.key;
+    if(filter_keys && !repeated_key) keys.push_back(kv.key);
+    if(run.size == 0) run.min_key = kv.key;
+    run.max_key = kv.key;
+    run.size += 1;
+    if(page_count == 0) mins.push_back(kv.key);
+    page_count += 1;
+    if(options->page_summaries) add_to_summary(summary, kv, repeated_key);
+    if(page_count == options->kvpair_per_page){
+        summaries.push_back(summary);
+        summary = PageSummary();
+        page_count = 0;
+    }
+}
+
+/**
+ Write what is left, then create the filter for the level the run goes to,
+ sized for its exact number of keys, and the fence index
+ @param tracer records the time spent building them, can be NULL
+ */
+void RunBuilder::finish(int rank, EventTracer* tracer){
+    writer.finish();
+    if(page_count > 0) summaries.push_back(summary);
+    if(filter_keys && rank < options->level_with_bf()-1 && run.size > 0){
+        TraceSpan span(tracer, "build filter", "build");
+        span.arg("level", rank);
+        span.arg("entries", run.size);
+        run.filter = create_filter(keys, options->fprate(rank), options->filter_type(rank));
+    }
+    //a run within one page does not need them
+    if(run.size > options->kvpair_per_page){
+        TraceSpan span(tracer, "build fence index", "build");
+        span.arg("level", rank);
+        span.arg("entries", run.size);
+        run.index = new FenceIndex(mins, run.max_key, options->fence_block_pages);
+        run.index->write(run.name);
+        if(options->page_summaries){
+            run.summaries = new PageSummary[summaries.size()];
+            std::copy(summaries.begin(), summaries.end(), run.summaries);
+        }
+    }
+}
+
+/**
+ RangeCursor
+ Only the pages of the run the fence index finds for [low, high) are read
+ */
+RangeCursor::RangeCursor(const Run& run, unsigned long page_size, int low, int high){
+    this->run = &run;
+    this->page_size = page_size;
+    this->low = low;
+    this->high = high;
+    fd = open(run.name.c_str(), O_RDONLY);
+    if(fd < 0) std::cout<<"Error opening the file"<<std::endl;
+    if(run.index != NULL){
+        if(run.index->overlap(low, high, first_page, last_page)){
+            run.index->page_mins(first_page, last_page, mins);
+            page = first_page;
+        }else{
+            last_page = -1;
+        }
+    }else if(run.size > 0){
+        last_page = 0;
+    }
+}
+
+/**
+ @param entries sorted by key, then newest first
+ */
+RangeCursor::RangeCursor(std::vector<KVpair>& entries){
+    data.swap(entries);
+}
+
+RangeCursor::~RangeCursor(){
+    if(fd >= 0) close(fd);
+}
+
+/**
+ Read the next page, keeping its entries within [low, high)
+ @return false when no page is left
+ */
+bool RangeCursor::load(){
+    while(position == data.size()){
+        if(run == NULL || page > last_page) return false;
+        unsigned long offset = page*page_size;
+        unsigned long read_size = run->index != NULL ? std::min(page_size, run->size-offset) : run->size;
+        data.resize(read_size);
+        if(pread(fd, data.data(), read_size*sizeof(KVpair), offset*sizeof(KVpair)) != (ssize_t)(read_size*sizeof(KVpair))){
+            std::cout<<"Error reading the file"<<std::endl;
+            data.clear();
+        }
+        page += 1;
+        unsigned long begin = 0;
+        if(skipped){
+            while(begin < data.size() && data[begin].key == skipped_key) begin++;
+            skipped = begin == data.size();
+        }
+        //keep the slice within [low, high)
+        unsigned long end = page_lower_bound(data.data(), data.size(), high);
+        begin = std::max(begin, page_lower_bound(data.data(), data.size(), low));
+        data.resize(std::max(end, begin));
+        data.erase(data.begin(), data.begin() + begin);
+        position = 0;
+    }
+    return true;
+}
+
+bool RangeCursor::valid(){
+    return load();
+}
+
+KVpair& RangeCursor::peek(){
+    return data[position];
+}
+
+void RangeCursor::next(){
+    position += 1;
+}
+
+/**
+ @return whether the entries read so far are used up and another page of the run is left
+ */
+bool RangeCursor::at_page_start(){
+    return position == data.size() && run != NULL && run->index != NULL && page <= last_page;
+}
+
+/**
+ Bounds of the next page, only when at_page_start
+ The max is exact when the run has summaries
+ */
+const FencePointer& RangeCursor::next_page(){
+    bounds.min = mins[page-first_page];
+    bounds.max = run->summaries != NULL ? run->summaries[page].last_key : mins[page-first_page+1];
+    return bounds;
+}
+
+/**
+ Summary of the next page, only when at_page_start
+ @return NULL when the run has no summaries
+ */
+const PageSummary* RangeCursor::next_summary(){
+    return run->summaries != NULL ? &run->summaries[page] : NULL;
+}
+
+void RangeCursor::skip_page(){
+    skipped = true;
+    skipped_key = run->summaries[page].last_key;
+    page += 1;
+}
+
+/**
+ Smallest key left without reading a page, only when valid or at_page_start
+ */
+int RangeCursor::head_key(){
+    if(at_page_start()) return next_page().min;
+    return peek().key;
+}
+
+/**
+ Merge all runs to one run in this level, streaming through the runs
  NOTE: Can't use heap to do the merge sort because we need to maintain the order of runs to know
  which are the newest values
- Use temp vector to store the merged result then write to file: minimize number of I/O
- @param size stores the size of the resulting run
- @return the name of the file of the new run
+ Memory use is bounded: two read-ahead chunks per run and two chunks for the output, the next
+ chunks are read and the full ones written in the background while merging; under the memory
+ limit the chunks shrink, down to a page, to fit in what the limit leaves
+ The limit is best-effort for the keys kept to build the filter: a filter is sized by, and the
+ xor filter built from, every key of the run, so they are charged in full even past the limit
+ @param io the backend doing the reads and writes
+ new_run stores the resulting run, its name is the file to write,
+ run_<rank>_temp of this layer when empty
+ drop_tombstones when true, tombstones are left out of the resulting run
+ snapshots the sequence numbers of the live snapshots, sorted, the versions they see are kept
+ @return false when the resulting run is empty
  */
-std::string Layer::pagewise_merge(unsigned long &new_run_size, BloomFilter*& bf, FencePointer*& fp, int &num_pointers){
-    //read files and set index
-    KVpair read_runs[parameters::NUM_RUNS][parameters::KVPAIRPERPAGE];
-    int read_runs_length[parameters::NUM_RUNS] = {0};
-    int current_read_length[parameters::NUM_RUNS] = {0};
-    for(int i = 0; i < parameters::NUM_RUNS; i++){
-        //TODO: change to an array of open files
-        std::ifstream inStream(get_name(i), std::ios::binary);
-        int read_length = std::min(parameters::KVPAIRPERPAGE, run_size[i] - read_runs_length[i]);
-        current_read_length[i] = read_length;
-        inStream.read((char*)read_runs[i], read_length*sizeof(KVpair));
-        read_runs_length[i] += read_length;
-        inStream.close();
+bool Layer::pagewise_merge(IOBackend* io, Run& new_run, bool drop_tombstones, const std::vector<unsigned long>& snapshots){
+    int num = runs.size();
+    unsigned long page_size = options->kvpair_per_page;
+    unsigned long read_chunk = options->read_ahead_pages*page_size;
+    unsigned long write_chunk = options->write_behind_pages*page_size;
+    bool filtered = rank < options->level_with_bf()-1;
+    long reserved = 0;
+    if(memory != NULL){
+        //the keys for the filter take at most one int per entry, only the chunks can give way
+        unsigned long entries = 0;
+        for(int i = 0; i < num; i++) entries += runs[i].size;
+        unsigned long keys = filtered ? entries*sizeof(int) : 0;
+        unsigned long chunks = 2*(num*read_chunk + write_chunk)*sizeof(KVpair);
+        unsigned long room = memory->available();
+        if(keys + chunks > room){
+            //every chunk shrinks by the same factor
+            double factor = room > keys ? (double)(room - keys)/chunks : 0;
+            read_chunk = std::max((unsigned long)(read_chunk*factor), page_size);
+            write_chunk = std::max((unsigned long)(write_chunk*factor), page_size);
+        }
+        reserved = keys + 2*(num*read_chunk + write_chunk)*sizeof(KVpair);
+        memory->charge(MEMORY_MERGES, reserved);
+    }
+    //open the runs, the first chunks are read right away
+    std::vector<RunReader*> readers(num);
+    for(int i = 0; i < num; i++){
+        readers[i] = new RunReader(io, runs[i].name, runs[i].size, read_chunk);
     }
-    
-    //set up the file to write
-    std::string name = "run_" + std::to_string(rank) + "_temp";
-    std::ofstream new_file(name, std::ios::binary);
-    
-    //set up bloom filter and fence pointer for the new run
-    unsigned long size_ceiling = 0;
-    for(int i = 0; i < parameters::NUM_RUNS; i++) size_ceiling += run_size[i];
-    double fprate = parameters::FPRATE0*pow(parameters::SIZE_RATIO, rank);
-    if(rank < parameters::LEVELWITHBF-1) bf = new BloomFilter(size_ceiling, fprate);
-    std::vector<FencePointer> Fence_buffer;
-    
+
+    //set up the file to write, the filter and the fence index are built along
+    if(new_run.name.empty()) new_run.name = get_temp_name();
+    RunBuilder* builder = new RunBuilder(io, new_run, options, rate_limiter, write_chunk, filtered);
+
+    std::vector<RangeTombstone> range_tombstones;
+    for(int i = 0; i < num; i++){
+        range_tombstones.insert(range_tombstones.end(), runs[i].range_tombstones.begin(), runs[i].range_tombstones.end());
+    }
+
     //perform merge
-    int current_positions[parameters::NUM_RUNS] = {0}; //current position in the page
-    KVpair merge_buffer[parameters::KVPAIRPERPAGE];
-    int index_merge_buffer = 0;
-    int ct = parameters::NUM_RUNS; //the count of active arrays
-    int min;
-    unsigned long new_run_count = 0;
-    while(ct > 0){
-        std::vector<int> indexes_min_run;
-        min = INT_MAX;
-        //there is no duplicate inside each run, scan from the old runs to the new runs
-        for(int i = 0; i < parameters::NUM_RUNS; i++){
-            if(current_positions[i] >= 0){
-                if(read_runs[i][current_positions[i]].key < min){
-                    min = read_runs[i][current_positions[i]].key;
-                    indexes_min_run.clear();
-                    indexes_min_run.push_back(i);
-                }else if (read_runs[i][current_positions[i]].key == min){
-                    indexes_min_run.push_back(i);
+    //the run with the smallest key gives the next keys as long as they stay below the heads of
+    //the other runs, so disjoint runs are read one after the other without comparing every head
+    std::vector<KVpair> versions;
+    std::vector<KVpair> kept;
+    int source = -1;
+    int bound = INT_MIN;
+    while(true){
+        versions.clear();
+        if(source >= 0 && readers[source]->valid() && readers[source]->peek().key < bound){
+            int min = readers[source]->peek().key;
+            while(readers[source]->valid() && readers[source]->peek().key == min){
+                versions.push_back(readers[source]->peek());
+                readers[source]->next();
+            }
+        }else{
+            //bound is the second smallest head, the smallest one when two runs hold it
+            int min = INT_MAX;
+            source = -1;
+            bound = INT_MAX;
+            for(int i = 0; i < num; i++){
+                if(!readers[i]->valid()) continue;
+                int key = readers[i]->peek().key;
+                if(source < 0 || key < min){
+                    if(source >= 0) bound = min;
+                    min = key;
+                    source = i;
+                }else if(key < bound){
+                    bound = key;
                 }
             }
-        }
-        int min_index = indexes_min_run.back();
-        //write to merge buffer
-        merge_buffer[index_merge_buffer] = read_runs[min_index][current_positions[min_index]];
-        if(bf != NULL) bf->add(merge_buffer[index_merge_buffer].key);
-        index_merge_buffer += 1;
-        new_run_count += 1;
-        if(index_merge_buffer == parameters::KVPAIRPERPAGE){
-            //merge buffer is full, write to file and reset the merge buffer
-            FencePointer fp_temp;
-            fp_temp.min = merge_buffer[0].key;
-            fp_temp.max = merge_buffer[index_merge_buffer-1].key;
-            Fence_buffer.push_back(fp_temp);
-            new_file.write((char*)merge_buffer, index_merge_buffer*sizeof(KVpair));
-            index_merge_buffer = 0;
-        }
-        for(int i = 0; i < indexes_min_run.size(); i++){
-            int cur_index = indexes_min_run.at(i);
-            current_positions[cur_index] += 1;
-            if(current_positions[cur_index] >= current_read_length[cur_index]){
-                //Current page is used up for this page
-                //set index to -1 when the the last element of the array is used
-                if(read_runs_length[cur_index] >= run_size[cur_index]){
-                    current_positions[cur_index] = -1;
-                    ct -= 1;
-                }else{
-                    current_positions[cur_index] = 0;
-                    std::ifstream inStream(get_name(cur_index), std::ios::binary);
-                    inStream.seekg(read_runs_length[cur_index]*sizeof(KVpair));
-                    int read_length = std::min(parameters::KVPAIRPERPAGE, run_size[cur_index] - read_runs_length[cur_index]);
-                    inStream.read((char*)read_runs[cur_index], read_length*sizeof(KVpair));
-                    current_read_length[cur_index] = read_length;
-                    read_runs_length[cur_index] += read_length;
-                    inStream.close();
+            if(source < 0) break;
+            //gather every version of the key, a run can hold several
+            for(int i = 0; i < num; i++){
+                while(readers[i]->valid() && readers[i]->peek().key == min){
+                    versions.push_back(readers[i]->peek());
+                    readers[i]->next();
                 }
             }
         }
+        std::sort(versions.begin(), versions.end(), compareNewest);
+        kept.clear();
+        keep_versions(versions, range_tombstones, snapshots, drop_tombstones, options->merge_operator, kept);
+        //write to the output
+        for(int j = 0; j < kept.size(); j++){
+            builder->add(kept[j]);
+        }
     }
-    //write the remaining part in the merge_buffer to the result
-    FencePointer fp_temp;
-    fp_temp.min = merge_buffer[0].key;
-    fp_temp.max = merge_buffer[index_merge_buffer-1].key;
-    Fence_buffer.push_back(fp_temp);
-    new_file.write((char*)merge_buffer, index_merge_buffer*sizeof(KVpair));
-    new_file.close();
-    
-    //create fence pointer
-    num_pointers = Fence_buffer.size();
-    new_run_size = new_run_count;
-    FencePointer* fparray = new FencePointer[num_pointers];
-    std::copy(Fence_buffer.begin(), Fence_buffer.end(), fparray);
-    fp = fparray;
-    
+    builder->finish(rank, tracer);
+    delete builder;
+    for(int i = 0; i < num; i++){
+        delete readers[i];
+    }
+    if(memory != NULL) memory->charge(MEMORY_MERGES, -reserved);
+
+    //the range tombstones still hide older versions in the following levels
+    prune_range_tombstones(range_tombstones, snapshots, drop_tombstones);
+    new_run.range_tombstones.swap(range_tombstones);
+    if(new_run.size == 0 && new_run.range_tombstones.empty()){
+        //every entry was a dropped tombstone
+        remove(new_run.name.c_str());
+        reset();
+        return false;
+    }
+
     //reset the layer, free the dynamic memory
     reset();
-    return name;
+    return true;
 };
 
+/**
+ Whether the runs can be put end to end instead of merged: their key ranges don't overlap,
+ so no key has versions in two runs, and no tombstone has to go
+ Range tombstones can hide keys of other runs, the runs are merged then, as they are
+ when the result would span more than max_run_segments files
+ */
+bool Layer::disjoint(bool drop_tombstones){
+    std::vector<const Run*> sorted;
+    for(int i = 0; i < runs.size(); i++){
+        if(!runs[i].range_tombstones.empty()) return false;
+        if(drop_tombstones && runs[i].tombstones > 0) return false;
+        if(runs[i].size > 0) sorted.push_back(&runs[i]);
+    }
+    if(sorted.empty() || sorted.size() > options->max_run_segments) return false;
+    std::sort(sorted.begin(), sorted.end(), [](const Run* a, const Run* b){return a->min_key < b->min_key;});
+    for(int i = 1; i < sorted.size(); i++){
+        if(sorted[i-1]->max_key >= sorted[i]->min_key) return false;
+    }
+    return true;
+}
+
+/**
+ Put the runs of the layer end to end in key order, they must be disjoint
+ Nothing is read or written: the runs keep their files, filters, fence indexes and page
+ summaries, and become the segments of one run, each continued by the next
+ 
+ @param segments stores the runs in key order, to add to the next layer in that order
+ */
+void Layer::concatenate(std::vector<Run>& segments){
+    close_runs();
+    for(int i = 0; i < runs.size(); i++){
+        if(runs[i].size > 0){
+            segments.push_back(runs[i]);
+            continue;
+        }
+        delete runs[i].filter;
+        delete runs[i].index;
+        delete [] runs[i].summaries;
+        remove(runs[i].name.c_str());
+    }
+    runs.clear();
+    std::sort(segments.begin(), segments.end(), [](const Run& a, const Run& b){return a.min_key < b.min_key;});
+    for(int i = 0; i < segments.size(); i++){
+        segments[i].continued = i+1 < segments.size();
+        //a merge of this layer would not build filters either
+        if(rank >= options->level_with_bf()-1){
+            delete segments[i].filter;
+            segments[i].filter = NULL;
+        }
+    }
+}
+
+/**
+ Rename a file, copying it when the new name is on another file system
+ */
+bool move_file(const std::string& from, const std::string& to){
+    if(rename(from.c_str(), to.c_str()) == 0) return true;
+    if(errno != EXDEV) return false;
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    out << in.rdbuf();
+    if(!out.good()) return false;
+    in.close();
+    return remove(from.c_str()) == 0;
+}
+
 /**
  Add new run from the previous level of the LSM tree
  
- @param run the pointer to the new run
- size the size of the new run
+ @param run the new run, or a segment of a concatenated one, its file is renamed to the
+ name of the run in this layer, the filter and the fence index are owned by the layer afterwards
  @return when true, the layer has reached its limit
  */
-bool Layer::add_run(std::string run, unsigned long size, BloomFilter* bf, FencePointer* fp, int num_pointers){
-    std::string newName = get_name(current_run);
-    if(rename(run.c_str(), newName.c_str()) != 0){
+bool Layer::add_run(Run& run){
+    std::string newName = get_name(runs.size());
+    if(!move_file(run.name, newName)){
         std::cout << "rename failed"<<std::endl;
     };
-    runs[current_run] = newName;
-    run_size[current_run] = size;
-    filters[current_run] = bf;
-    pointers[current_run] = fp;
-    pointer_size[current_run] = num_pointers;
-    current_run += 1;
-    return current_run >= parameters::NUM_RUNS;
+    run.name = newName;
+    place_index(run);
+    runs.push_back(run);
+    return full();
 }
 
+/**
+ The runs of the deep levels keep only the directory of their fence index in memory,
+ the blocks are read from the run file through the fence cache
+ */
+void Layer::place_index(Run& run){
+    if(run.index != NULL && fence_cache != NULL && rank >= options->lazy_fence_rank){
+        run.index->make_lazy(run.name, run.size*sizeof(KVpair), fence_cache);
+    }
+}
+
+void Layer::set_fence_cache(FenceCache* cache){
+    fence_cache = cache;
+}
+
+/**
+ The limiter the flushes to the layer and its merges wait for, NULL for no limit
+ */
+void Layer::set_rate_limiter(RateLimiter* limiter){
+    rate_limiter = limiter;
+}
+
+/**
+ The tracer the layer records the building of filters and fence indexes to, NULL for none
+ */
+void Layer::set_event_tracer(EventTracer* event_tracer){
+    tracer = event_tracer;
+}
+
+/**
+ The tracker the merges of the layer reserve their buffers with, NULL for no accounting
+ */
+void Layer::set_memory_tracker(MemoryTracker* tracker){
+    memory = tracker;
+}
+
+/**
+ @param filters stores the bytes of the filters of the runs
+ indexes stores the bytes of their fence indexes and page summaries
+ */
+void Layer::memory_usage(unsigned long& filters, unsigned long& indexes){
+    filters = 0;
+    indexes = 0;
+    for(int i = 0; i < runs.size(); i++){
+        if(runs[i].filter != NULL) filters += runs[i].filter->size_in_bits()/8;
+        if(runs[i].index != NULL){
+            indexes += runs[i].index->size_in_bytes();
+            if(runs[i].summaries != NULL) indexes += runs[i].index->num_pages()*sizeof(PageSummary);
+        }
+    }
+}
+
+
+/**
+ Find the part of the run that can hold the key with the fence index
+ 
+ @param key The key to look for
+ index: the index number of the run in the level
+ offset: stores the position of the first KVpair to read
+ read_size: stores the number of KVpairs to read
+ @return false when the key is outside of every page of the run
+ */
+bool Layer::locate(int key, int index, unsigned long& offset, unsigned long& read_size){
+    Run& run = runs[index];
+    offset = 0;
+    read_size = run.size;
+    //check the fence index, the versions of a key can go on over the following pages
+    if(run.index != NULL){
+        int first, last;
+        if(!run.index->find(key, first, last)) return false;
+        offset = first*options->kvpair_per_page;
+        read_size = std::min((last-first+1)*options->kvpair_per_page, (run.size-offset));
+    }
+    return true;
+}
+
+/**
+ Look for the newest version of the key visible at the snapshot in pages read from a run
+ An operand is applied to the older versions of the run down to a value or a tombstone
+ @param tombstone_seq the newest range tombstone of the run deleting the key, 0 when none
+ seq stores the sequence number of the version found
+ @return 1:found, 0:not found, -1:deleted, 2:operands found, to apply to the older runs
+ */
+int search_page(KVpair* page, unsigned long size, int key, unsigned long snapshot, unsigned long tombstone_seq, const MergeOperator* merge_operator, int& value, unsigned long& seq){
+    //the versions of a key are sorted from the newest, the ones after the snapshot are passed
+    unsigned long i = page_lower_bound(page, size, key);
+    while(i < size && page[i].key == key && page[i].seq > snapshot) i++;
+    if(i == size || page[i].key != key) return 0;
+    KVpair* it = page + i;
+    seq = it->seq;
+    if(it->del) return -1;
+    value = it->value;
+    for(i += 1; page[i-1].operand; i++){
+        //the range tombstone deletes what the older runs hold
+        if(i == size || page[i].key != key) return tombstone_seq > 0 ? 1 : 2;
+        if(page[i].del || page[i].seq < tombstone_seq) return 1;
+        value = merge_operator->combine(page[i].value, value);
+    }
+    return 1;
+}
 
 /**
 Check if the key is in the run
@@ -443,45 +1522,57 @@ Check if the key is in the run
  @param key The key to check
 value the value associated with the key
  index: the index number of the run in the level
- @return 1:found, 0:not found, -1:deleted
- */
-int Layer::check_run(int key, int& value, int index){
-    //indexes for the fence pointer
-    unsigned long int offset = 0;
-    bool valid = false;
-    //check the fence pointer
-    if(pointers[index] != NULL){
-        for(int i = 0; i < pointer_size[index]; i++){
-            if(key>= pointers[index][i].min && key <= pointers[index][i].max){
-                offset = i*parameters::KVPAIRPERPAGE;
-                valid = true;
-                break;
-            }
-        }
-        if(!valid) return 0;
-    }
-    //read the needed page from the file
-    unsigned long read_size = run_size[index];
-    if(valid){
-        read_size = std::min(parameters::KVPAIRPERPAGE, (run_size[index]-offset));
-    }
-    KVpair* curRun = new KVpair[read_size];
-    std::ifstream inStream(get_name(index), std::ios::binary);
-    inStream.seekg(offset*sizeof(KVpair));
-    inStream.read((char *)curRun, read_size*sizeof(KVpair));
-    inStream.close();
-    //TODO: change to binary search
-    for(int j = 0; j < read_size; j++){
-        if(curRun[j].key == key){
-            if(curRun[j].del){
-                return -1;
-            }else{
-                value = curRun[j].value;
-                return 1;
-            }
+ snapshot: only the versions up to this sequence number are seen
+ tombstone_seq: the newest range tombstone of the run deleting the key, 0 when none
+ seq: stores the sequence number of the version found
+ @return 1:found, 0:not found, -1:deleted, 2:operands found
+ */
+int Layer::check_run(int key, int& value, int index, unsigned long snapshot, unsigned long tombstone_seq, unsigned long& seq){
+    unsigned long offset = 0;
+    unsigned long read_size = 0;
+    if(!locate(key, index, offset, read_size)) return 0;
+    //read the needed page into a buffer kept by the thread, so lookups don't allocate
+    //once it is as large as the largest read
+    static thread_local std::vector<KVpair> page;
+    if(page.size() < read_size) page.resize(read_size);
+    int fd = run_fd(index);
+    if(fd < 0){
+        std::cout<<"Error opening the file"<<std::endl;
+        return 0;
+    }
+    ssize_t n = pread(fd, page.data(), read_size*sizeof(KVpair), offset*sizeof(KVpair));
+    if(n != (ssize_t)(read_size*sizeof(KVpair))){
+        std::cout<<"Error reading the file"<<std::endl;
+        return 0;
+    }
+    return search_page(page.data(), read_size, key, snapshot, tombstone_seq, options->merge_operator, value, seq);
+}
+
+/**
+ Collect the pages to read for the key in this level, from the newest run to the oldest,
+ so the reads of all the runs can be issued together
+ 
+ @param snapshot only the versions up to this sequence number are seen
+ reads the pages are appended to it
+ @return -1 when a range tombstone of the level deletes the key, older runs are skipped then
+ 0 otherwise
+ */
+int Layer::collect_reads(int key, unsigned long snapshot, std::vector<PageRead>& reads){
+    for(int i = runs.size()-1; i >= 0; i--){
+        unsigned long offset = 0;
+        unsigned long read_size = 0;
+        unsigned long tombstone_seq = covering_seq(runs[i].range_tombstones, key, snapshot);
+        if(key >= runs[i].min_key && key <= runs[i].max_key && (runs[i].filter == NULL || runs[i].filter->possiblyContains(key)) &&
+           locate(key, i, offset, read_size) && read_size > 0){
+            PageRead page;
+            page.fd = run_fd(i);
+            page.offset = offset;
+            page.size = read_size;
+            page.tombstone_seq = tombstone_seq;
+            reads.push_back(page);
         }
+        if(tombstone_seq > 0) return -1;
     }
-    delete[] curRun;
     return 0;
 }
 
@@ -490,69 +1581,97 @@ int Layer::check_run(int key, int& value, int index){
  @return 1: found
  0: not found
  -1: (latest version)deleted, which means no need to go on searching
+ 2: operands found, value holds them folded, they apply to the older levels
  */
-int Layer::get(int key, int& value){
-    for(int i = current_run-1; i >= 0; i--){
-        if(rank >= parameters::LEVELWITHBF){
-            int c = check_run(key, value, i);
-            if(c!=0) return c;
-        }else{
-            if(filters[i]->possiblyContains(key)){
-                int c = check_run(key, value, i);
-                if(c!=0) return c;
-            }
+int Layer::get(int key, int& value, unsigned long snapshot){
+    int c = 0;
+    for(int i = runs.size()-1; i >= 0; i--){
+        int found = 0;
+        int run_value = 0;
+        unsigned long seq = 0;
+        unsigned long tombstone_seq = covering_seq(runs[i].range_tombstones, key, snapshot);
+        //deep levels and runs without entries have no bloom filter, the key range
+        //passes over the other segments of a concatenated run
+        if(key >= runs[i].min_key && key <= runs[i].max_key && (runs[i].filter == NULL || runs[i].filter->possiblyContains(key))){
+            found = check_run(key, run_value, i, snapshot, tombstone_seq, seq);
         }
+        //a range tombstone of the run hides the versions older than itself
+        if(tombstone_seq > seq) found = -1;
+        c = apply_older(options->merge_operator, c, value, found, run_value);
+        if(c == 1 || c == -1) return c;
     }
-    return 0;
+    return c;
 };
 
 /**
  Do range query on the whole run
+ @param range_deleted the range tombstones seen so far, keys covered by them are skipped
  */
-void Layer::range(int low, int high, std::unordered_map<int, KVpair>& range_buffer){
-    for(int i = current_run-1; i >= 0; i--){
-        range_run(low, high, range_buffer, i);
+void Layer::range(int low, int high, unsigned long snapshot, std::unordered_map<int, KVpair>& range_buffer, std::vector<RangeTombstone>& range_deleted){
+    for(int i = runs.size()-1; i >= 0; i--){
+        range_run(low, high, snapshot, range_buffer, range_deleted, i);
     }
 };
 
 /**
  Do range query on a run
+ The range tombstones of the run are added to range_deleted afterwards, as they only hide older runs
  */
-void Layer::range_run(int low, int high, std::unordered_map<int, KVpair>& range_buffer, int index){
+void Layer::range_run(int low, int high, unsigned long snapshot, std::unordered_map<int, KVpair>& range_buffer, std::vector<RangeTombstone>& range_deleted, int index){
+    Run& run = runs[index];
+    unsigned long page_size = options->kvpair_per_page;
     std::vector<int> offsets;
     std::vector<unsigned long> read_sizes;
-    
-    //check the fence pointer
-    if(pointers[index] != NULL){
-        for(int i = 0; i < pointer_size[index]; i++){
-            if(!(high <= pointers[index][i].min || low > pointers[index][i].max)){
-                offsets.push_back(i*parameters::KVPAIRPERPAGE);
-                read_sizes.push_back(std::min(parameters::KVPAIRPERPAGE, (run_size[index]-offsets.back())));
+
+    //check the key range, then the fence index
+    bool overlaps = run.size > 0 && low <= run.max_key && high > run.min_key;
+    if(overlaps && run.index != NULL){
+        int first, last;
+        if(run.index->overlap(low, high, first, last)){
+            for(int i = first; i <= last; i++){
+                offsets.push_back(i*page_size);
+                read_sizes.push_back(std::min(page_size, (run.size-offsets.back())));
             }
         }
-    }
-    if(offsets.empty()){
+    }else if(overlaps){
         offsets.push_back(0);
-        read_sizes.push_back(run_size[index]);
+        read_sizes.push_back(run.size);
     }
-    
-    //read the needed page from the file
-    for(int i = 0; i < offsets.size(); i++){
-        int offset = offsets.at(i);
+
+    //read the needed pages from the file, one at a time into a buffer kept by the thread
+    static thread_local std::vector<KVpair> curRun;
+    int fd = offsets.empty() ? -1 : open(run.name.c_str(), O_RDONLY);
+    //the first version visible at the snapshot is the newest one, unless it is an operand the older
+    //ones are passed without looking the key up, they can go on in the next page
+    bool decided = false;
+    int decided_key = 0;
+    for(int i = 0; i < offsets.size() && fd >= 0; i++){
         unsigned long read_size = read_sizes.at(i);
-        KVpair* curRun = new KVpair[read_size];
-        std::ifstream inStream(get_name(index), std::ios::binary);
-        inStream.seekg(offset*sizeof(KVpair));
-        inStream.read((char *)curRun, read_size*sizeof(KVpair));
-        inStream.close();
-        //TODO: change to binary search
-        for(int j = 0; j < read_size; j++){
-            int key = curRun[j].key;
-            if(key < high && key >= low && range_buffer.find(key) == range_buffer.end()){
-                range_buffer[key] = curRun[j];
+        if(curRun.size() < read_size) curRun.resize(read_size);
+        if(pread(fd, curRun.data(), read_size*sizeof(KVpair), offsets.at(i)*sizeof(KVpair)) != (ssize_t)(read_size*sizeof(KVpair))){
+            std::cout<<"Error reading the file"<<std::endl;
+            break;
+        }
+        //only the slice within [low, high) is scanned
+        unsigned long end = page_lower_bound(curRun.data(), read_size, high);
+        for(unsigned long j = page_lower_bound(curRun.data(), read_size, low); j < end; j++){
+            const KVpair& kv = curRun[j];
+            if(kv.seq > snapshot || (decided && kv.key == decided_key)) continue;
+            decided_key = kv.key;
+            auto it = range_buffer.find(kv.key);
+            if(it != range_buffer.end() && !it->second.operand){
+                decided = true;
+                continue;
             }
+            bool deleted = covering_seq(range_deleted, kv.key, snapshot) != 0 || covering_seq(run.range_tombstones, kv.key, snapshot) > kv.seq;
+            decided = add_to_range(range_buffer, kv, deleted, options->merge_operator);
+        }
+    }
+    if(fd >= 0) close(fd);
+    for(int i = 0; i < run.range_tombstones.size(); i++){
+        if(run.range_tombstones[i].low < high && run.range_tombstones[i].high > low && run.range_tombstones[i].seq <= snapshot){
+            range_deleted.push_back(run.range_tombstones[i]);
         }
-        delete[] curRun;
     }
 
 }
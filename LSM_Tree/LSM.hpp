@@ -16,76 +16,386 @@
 #include <iostream>
 #include <unordered_map>
 #include "Bloom_Filter.hpp"
+#include "Xor_Filter.hpp"
+#include "Fence_Index.hpp"
+#include "Rate_Limiter.hpp"
+#include "IO_Backend.hpp"
+#include "Page_Search.hpp"
+#include "Event_Tracer.hpp"
+#include "Merge_Operator.hpp"
+#include "Memory_Tracker.hpp"
 #include <math.h>
+#include <climits>
 
+/*
+ Every write gets the next sequence number, starting from 1
+ Reads at MAX_SEQ see the latest version of every key
+ */
+const unsigned long MAX_SEQ = ULONG_MAX;
+
+/*
+ operand: the value is an operand of the merge operator, to apply to the next older version of the key
+ */
 struct KVpair{
     int key;
     int value;
     bool del;
+    bool operand = false;
+    unsigned long seq;
 };
 
 
 bool compareKVpair(KVpair pair1, KVpair pair2);
 
+/*
+ Bounds of a page, max can be the smallest key of the next page when the exact one isn't kept
+ */
 struct FencePointer{
     int min;
     int max;
 };
 
-namespace parameters
-{
-    const unsigned int BUFFER_CAPACITY = 1024;
-    const unsigned int SIZE_RATIO = 4;
-    const unsigned int NUM_RUNS = SIZE_RATIO;
-    const double FPRATE0 = 0.001;
+/*
+ Summary of the values of a page, kept next to its fence pointer so that
+ aggregates can use it instead of reading the page
+ clean: the page holds one version per key, no tombstone and no operand
+ */
+struct PageSummary{
+    unsigned long count = 0;
+    long long sum = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    unsigned long min_seq = ULONG_MAX;
+    unsigned long max_seq = 0;
+    int last_key;
+    bool clean = true;
+};
+
+void add_to_summary(PageSummary& summary, const KVpair& kv, bool repeated_key);
+
+/*
+ Result of an aggregate range query
+ */
+struct Aggregate{
+    unsigned long count = 0;
+    long long sum = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    //pages answered from their summary
+    unsigned long summarized_pages = 0;
+    void add(int value);
+    void add(const PageSummary& summary);
+};
+
+/*
+ Deletes every key in [low, high) that is older than the tombstone
+ */
+struct RangeTombstone{
+    int low;
+    int high;
+    unsigned long seq;
+};
+
+unsigned long covering_seq(const std::vector<RangeTombstone>& range_tombstones, int key, unsigned long snapshot);
+bool needed(unsigned long seq, unsigned long newer, const std::vector<unsigned long>& snapshots);
+void prune_range_tombstones(std::vector<RangeTombstone>& range_tombstones, const std::vector<unsigned long>& snapshots, bool drop_tombstones);
+void keep_versions(std::vector<KVpair>& versions, const std::vector<RangeTombstone>& range_tombstones, const std::vector<unsigned long>& snapshots, bool drop_tombstones, const MergeOperator* merge_operator, std::vector<KVpair>& kept);
+int apply_older(const MergeOperator* merge_operator, int c, int& value, int older, int older_value);
+bool add_to_range(std::unordered_map<int, KVpair>& res, const KVpair& kv, bool deleted, const MergeOperator* merge_operator);
+
+/*
+ Pages of a run that have to be read for a lookup
+ fd is the run file, open as long as the run is in its layer
+ offset and size are in KVpairs
+ tombstone_seq is the newest range tombstone of the run deleting the key, 0 when none
+ */
+struct PageRead{
+    int fd;
+    unsigned long offset;
+    unsigned long size;
+    unsigned long tombstone_seq;
+};
+
+int search_page(KVpair* page, unsigned long size, int key, unsigned long snapshot, unsigned long tombstone_seq, const MergeOperator* merge_operator, int& value, unsigned long& seq);
+
+/*
+ Tuning knobs of a tree, each tree has its own copy
+ The defaults are the values the tree was designed with
+ */
+struct Options{
+    unsigned int buffer_capacity = 1024;
+    //number of runs a level holds before it is merged into the next one
+    unsigned int size_ratio = 4;
+    double fprate0 = 0.001;
     /*
      reference: https://apple.stackexchange.com/questions/78802/what-are-the-sector-sizes-on-mac-os-x
      Unit: Bytes
      */
-    const unsigned long int KVPAIRPERPAGE = 4096/sizeof(KVpair);
-    const double FPTHRESHOLD = 0.8;
-    const int LEVELWITHBF = (int)log(FPTHRESHOLD/FPRATE0)/log(parameters::SIZE_RATIO);
+    unsigned long int kvpair_per_page = 4096/sizeof(KVpair);
+    double fp_threshold = 0.8;
+    /*
+     When the fraction of tombstones in a level exceeds the threshold,
+     the level is compacted even if it is not full
+     */
+    double tombstone_threshold = 0.5;
+    /*
+     Chunk sizes of the merge, in pages: each run being merged is read ahead
+     two chunks at a time, and the result is written behind in two chunks
+     */
+    unsigned long int read_ahead_pages = 16;
+    unsigned long int write_behind_pages = 16;
+    //directory holding the run files, empty for the working directory
+    std::string data_dir;
+    /*
+     Directory of the run files of each level, the levels past the end use the last one,
+     empty for data_dir everywhere; the small upper levels can go on a fast device
+     */
+    std::vector<std::string> level_dirs;
+    /*
+     Filter of the runs of each level, the levels past the end use the last one,
+     empty for bloom filters everywhere
+     */
+    std::vector<FilterType> filter_types;
+    //number of keys the row cache holds, 0 for no row cache
+    unsigned long int row_cache_entries = 0;
+    //keep a summary of the values of each page next to the fence index
+    bool page_summaries = false;
+    //pages per block of the fence index
+    unsigned int fence_block_pages = 64;
+    //bytes of index blocks kept in memory for the lazy runs, 0 to keep every index in memory
+    unsigned long int fence_cache_bytes = 0;
+    //levels from this rank on read their index blocks from the run files on demand
+    int lazy_fence_rank = 2;
+    //bytes per second the flushes and merges may write, 0 for no limit
+    unsigned long int rate_limit = 0;
+    //factor of the rate while the levels fall behind
+    double rate_limit_boost = 4;
+    //events the tracer keeps for each thread, 0 for no tracing
+    unsigned long int trace_events = 0;
+    //microseconds a read or a write takes before the tracer records it
+    unsigned long int trace_slow_micros = 1000;
+    //applies the operands of Tree::merge, owned by the caller, NULL when the tree takes no operands
+    const MergeOperator* merge_operator = NULL;
+    /*
+     Bytes the buffer, filters, indexes, caches and merges may hold together, 0 for no limit;
+     the merges and bulk loads read and write through smaller chunks to stay within it,
+     but the keys a merge keeps for the filter of its run are not bounded by it
+     */
+    unsigned long int memory_limit = 0;
+    /*
+     Files a run can span: disjoint runs are concatenated by moving their files to the next
+     level as they are, until the run would span more than this, the level is merged then
+     */
+    unsigned int max_run_segments = 16;
     
-    // ... other related constants
-}
+    unsigned int num_runs() const;
+    int level_with_bf() const;
+    double fprate(int rank) const;
+    FilterType filter_type(int rank) const;
+    std::string path(const std::string& file) const;
+    std::string level_path(int rank, const std::string& file) const;
+};
 
 
 class Buffer{
 public:
     unsigned int size = 0;
-    KVpair data[parameters::BUFFER_CAPACITY];
-    bool put(int key, int value);
-    int get(int key, int& value);
-    bool del(int key);
+    unsigned int capacity;
+    std::vector<KVpair> data;
+    std::vector<RangeTombstone> range_tombstones;
+    Buffer(unsigned int capacity);
+    void set_capacity(unsigned int new_capacity);
+    void release();
+    unsigned long size_in_bytes();
+    unsigned long allocated_bytes();
+    bool put(int key, int value, unsigned long seq, const std::vector<unsigned long>& snapshots);
+    bool merge(int key, int operand, unsigned long seq, const MergeOperator* merge_operator, const std::vector<unsigned long>& snapshots);
+    int get(int key, int& value, unsigned long snapshot, const MergeOperator* merge_operator);
+    bool del(int key, unsigned long seq, const std::vector<unsigned long>& snapshots);
+    bool del_range(int low, int high, unsigned long seq, const std::vector<unsigned long>& snapshots);
+    bool write(const std::vector<KVpair>& points, const std::vector<RangeTombstone>& range_deletes, unsigned long seq, const MergeOperator* merge_operator, const std::vector<unsigned long>& snapshots);
     void sort();
-    void range(int low, int high, std::unordered_map<int, KVpair>& res);
+    void compact(const std::vector<unsigned long>& snapshots, const MergeOperator* merge_operator);
+    void range(int low, int high, unsigned long snapshot, const MergeOperator* merge_operator, std::unordered_map<int, KVpair>& res, std::vector<RangeTombstone>& range_deleted);
+};
+
+Filter* create_filter(const std::vector<int>& keys, double falPosRate, FilterType type);
+Filter* read_filter(std::istream& in);
+double filter_bits_per_key(FilterType type, double falPosRate);
+
+/*
+ Sequential reader of a run with read-ahead, used by the merge
+ */
+class RunReader{
+    IOBackend* io;
+    int fd;
+    unsigned long size;
+    unsigned long requested = 0;
+    unsigned long chunk_size;
+    KVpair* chunks[2];
+    IORequest requests[2];
+    bool issued[2];
+    int current;
+    unsigned long length;
+    unsigned long position;
+    void request(int i);
+    
+public:
+    RunReader(IOBackend* backend, std::string file, unsigned long run_size, unsigned long chunk);
+    ~RunReader();
+    bool valid();
+    KVpair& peek();
+    void next();
+};
+
+/*
+ Sequential writer of a run with write-behind, used by the merge
+ */
+class RunWriter{
+    IOBackend* io;
+    int fd;
+    unsigned long offset = 0;
+    unsigned long chunk_size;
+    KVpair* chunks[2];
+    IORequest requests[2];
+    bool pending[2];
+    int current = 0;
+    unsigned long length = 0;
+    RateLimiter* limiter;
+    void submit();
+    void wait(int i);
+    
+public:
+    RunWriter(IOBackend* backend, std::string file, unsigned long chunk, RateLimiter* rate_limiter = NULL);
+    ~RunWriter();
+    void add(const KVpair& kv);
+    void finish();
+};
+
+/*
+ A sorted run on disk with the metadata kept in memory
+ */
+struct Run{
+    std::string name;
+    unsigned long int size = 0;
+    unsigned long int tombstones = 0;
+    //the smallest and the largest key, meaningless when the run is empty
+    int min_key = INT_MAX;
+    int max_key = INT_MIN;
+    Filter* filter = NULL;
+    //NULL when the run fits in a page
+    FenceIndex* index = NULL;
+    //one per page when the options ask for them
+    PageSummary* summaries = NULL;
+    std::vector<RangeTombstone> range_tombstones;
+    //opened by the first lookup in the run, closed when the run leaves its layer, -1 until then
+    int fd = -1;
+    //the next run of the layer goes on with the keys of this one, they were put end to end
+    //by a concatenation and are counted as one run
+    bool continued = false;
 };
 
-BloomFilter* create_bloom_filter(KVpair* run, unsigned long int numEntries, double falPosRate);
+/*
+ Reads the entries of a run within [low, high) in order, a page at a time, only when needed
+ A cursor can also go through entries already in memory, sorted
+ */
+class RangeCursor{
+    const Run* run = NULL;
+    unsigned long page_size;
+    int low;
+    int high;
+    int fd = -1;
+    int page = 0;
+    int first_page = 0;
+    int last_page = -1;
+    //the smallest key of the pages to read, then the bound of the last one
+    std::vector<int> mins;
+    FencePointer bounds;
+    std::vector<KVpair> data;
+    unsigned long position = 0;
+    //older versions of the last key of a skipped page are left out
+    bool skipped = false;
+    int skipped_key;
+    bool load();
+
+public:
+    RangeCursor(const Run& run, unsigned long page_size, int low, int high);
+    RangeCursor(std::vector<KVpair>& entries);
+    ~RangeCursor();
+    bool valid();
+    KVpair& peek();
+    void next();
+    bool at_page_start();
+    const FencePointer& next_page();
+    const PageSummary* next_summary();
+    void skip_page();
+    int head_key();
+};
+
+/*
+ Writes the KVpairs of a run in order and builds its metadata on the way:
+ the fence index page by page, the distinct keys for the filter and the tombstone count
+ */
+class RunBuilder{
+    RunWriter writer;
+    Run& run;
+    const Options* options;
+    unsigned long page_count = 0;
+    std::vector<int> mins;
+    PageSummary summary;
+    std::vector<PageSummary> summaries;
+    //the distinct keys, for the filter
+    bool filter_keys;
+    std::vector<int> keys;
+
+public:
+    RunBuilder(IOBackend* io, Run& run, const Options* opts, RateLimiter* rate_limiter = NULL, unsigned long write_chunk = 0, bool filter_keys = true);
+    void add(const KVpair& kv);
+    void finish(int rank, EventTracer* tracer = NULL);
+};
 
 class Layer{
-    std::string runs[parameters::NUM_RUNS];
-    unsigned int current_run = 0;
+    std::vector<Run> runs;
     int rank = 0;
-    BloomFilter *filters[parameters::NUM_RUNS];
-    FencePointer *pointers[parameters::NUM_RUNS]  = {NULL};
-    int pointer_size[parameters::NUM_RUNS] = {0};
+    const Options* options;
+    FenceCache* fence_cache = NULL;
+    RateLimiter* rate_limiter = NULL;
+    EventTracer* tracer = NULL;
+    MemoryTracker* memory = NULL;
+    void place_index(Run& run);
+    int run_fd(int index);
+    void close_runs();
     
 public:
-    unsigned long int run_size[parameters::NUM_RUNS] = {0};
-    Layer();
+    Layer(const Options* opts);
     std::string get_name(int nthRun);
+    std::string get_temp_name();
+    unsigned int num_runs();
+    unsigned int num_sorted_runs();
+    const Run& get_run(int i);
+    bool full();
+    double tombstone_ratio();
     void reset();
-    int get(int key, int& value);
-    int check_run(int key, int& value, int i);
+    void release();
+    int get(int key, int& value, unsigned long snapshot);
+    int check_run(int key, int& value, int i, unsigned long snapshot, unsigned long tombstone_seq, unsigned long& seq);
+    bool locate(int key, int index, unsigned long& offset, unsigned long& read_size);
+    int collect_reads(int key, unsigned long snapshot, std::vector<PageRead>& reads);
     bool del(int key);
-    void range(int low, int high, std::unordered_map<int, KVpair>& range_buffer);
-    std::string merge(unsigned long &size, BloomFilter*& bf, FencePointer*& fp, int &num_pointers);
-    std::string pagewise_merge(unsigned long &size, BloomFilter*& bf, FencePointer*& fp, int &num_pointers);
+    void range(int low, int high, unsigned long snapshot, std::unordered_map<int, KVpair>& range_buffer, std::vector<RangeTombstone>& range_deleted);
+    bool merge(Run& new_run, bool drop_tombstones, const std::vector<unsigned long>& snapshots);
+    bool pagewise_merge(IOBackend* io, Run& new_run, bool drop_tombstones, const std::vector<unsigned long>& snapshots);
+    bool disjoint(bool drop_tombstones);
+    void concatenate(std::vector<Run>& segments);
     bool add_run_from_buffer(Buffer &buffer);
-    bool add_run(std::string run, unsigned long size, BloomFilter* bf, FencePointer* fp, int num_pointers);
+    bool add_run(Run& run);
     void set_rank(int r);
-    void range_run(int low, int high, std::unordered_map<int, KVpair>& range_buffer, int index);
+    void set_fence_cache(FenceCache* cache);
+    void set_rate_limiter(RateLimiter* limiter);
+    void set_event_tracer(EventTracer* event_tracer);
+    void set_memory_tracker(MemoryTracker* tracker);
+    void memory_usage(unsigned long& filters, unsigned long& indexes);
+    void range_run(int low, int high, unsigned long snapshot, std::unordered_map<int, KVpair>& range_buffer, std::vector<RangeTombstone>& range_deleted, int index);
     
 };
 #endif /* LSM_hpp */
@@ -0,0 +1,77 @@
+//
+//  Memory_Tracker.cpp
+//  LSM_Tree
+//
+
+#include "Memory_Tracker.hpp"
+#include <climits>
+
+/**
+ @param limit bytes all the components may hold together, 0 for no limit
+ */
+MemoryTracker::MemoryTracker(unsigned long limit){
+    this->limit = limit;
+    for(int i = 0; i < NUM_MEMORY_COMPONENTS; i++){
+        used[i] = 0;
+    }
+    peak = 0;
+}
+
+/**
+ @param bytes held from now on, negative when they are given back
+ */
+void MemoryTracker::charge(MemoryComponent component, long bytes){
+    used[component] += bytes;
+    if(bytes <= 0) return;
+    unsigned long held = total();
+    unsigned long seen = peak;
+    while(held > seen && !peak.compare_exchange_weak(seen, held));
+}
+
+unsigned long MemoryTracker::usage(MemoryComponent component){
+    long bytes = used[component];
+    return bytes > 0 ? bytes : 0;
+}
+
+unsigned long MemoryTracker::total(){
+    unsigned long sum = 0;
+    for(int i = 0; i < NUM_MEMORY_COMPONENTS; i++){
+        sum += usage((MemoryComponent)i);
+    }
+    return sum;
+}
+
+/**
+ @return the most the components held together so far
+ */
+unsigned long MemoryTracker::peak_total(){
+    return peak;
+}
+
+unsigned long MemoryTracker::get_limit(){
+    return limit;
+}
+
+/**
+ @return the bytes left under the limit, ULONG_MAX without a limit
+ */
+unsigned long MemoryTracker::available(){
+    if(limit == 0) return ULONG_MAX;
+    unsigned long held = total();
+    return held < limit ? limit - held : 0;
+}
+
+/**
+ @return the bytes of each component on one line
+ */
+std::string MemoryTracker::report(){
+    const char* names[NUM_MEMORY_COMPONENTS] = {"buffers", "filters", "indexes", "caches", "merges"};
+    std::string line;
+    for(int i = 0; i < NUM_MEMORY_COMPONENTS; i++){
+        line += std::string(names[i]) + " " + std::to_string(usage((MemoryComponent)i)) + ", ";
+    }
+    line += "total " + std::to_string(total());
+    if(limit > 0) line += " of " + std::to_string(limit);
+    line += ", peak " + std::to_string(peak_total());
+    return line;
+}
@@ -0,0 +1,48 @@
+//
+//  Memory_Tracker.hpp
+//  LSM_Tree
+//
+
+#ifndef Memory_Tracker_hpp
+#define Memory_Tracker_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <string>
+
+enum MemoryComponent{
+    //the write buffers
+    MEMORY_BUFFERS = 0,
+    MEMORY_FILTERS = 1,
+    //fence indexes and page summaries
+    MEMORY_INDEXES = 2,
+    //fence cache and row cache
+    MEMORY_CACHES = 3,
+    //read-ahead and write-behind chunks and filter keys of the merges and bulk loads running
+    MEMORY_MERGES = 4
+};
+
+const int NUM_MEMORY_COMPONENTS = 5;
+
+/*
+ Bytes held by the trees sharing it, by component, against one limit
+ The trees report what their structures hold as it changes, the merges reserve their buffers
+ for as long as they run and stream through smaller buffers when the limit leaves little room
+ */
+class MemoryTracker{
+    unsigned long limit;
+    std::atomic<long> used[NUM_MEMORY_COMPONENTS];
+    std::atomic<unsigned long> peak;
+
+public:
+    MemoryTracker(unsigned long limit);
+    void charge(MemoryComponent component, long bytes);
+    unsigned long usage(MemoryComponent component);
+    unsigned long total();
+    unsigned long peak_total();
+    unsigned long get_limit();
+    unsigned long available();
+    std::string report();
+};
+
+#endif /* Memory_Tracker_hpp */
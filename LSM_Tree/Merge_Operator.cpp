@@ -0,0 +1,22 @@
+//
+//  Merge_Operator.cpp
+//  LSM_Tree
+//
+
+#include "Merge_Operator.hpp"
+#include <algorithm>
+
+/**
+ Counters wrap around instead of overflowing
+ */
+int AddOperator::combine(int value, int operand) const{
+    return (int)((unsigned int)value + (unsigned int)operand);
+}
+
+int MaxOperator::combine(int value, int operand) const{
+    return std::max(value, operand);
+}
+
+int MinOperator::combine(int value, int operand) const{
+    return std::min(value, operand);
+}
@@ -0,0 +1,39 @@
+//
+//  Merge_Operator.hpp
+//  LSM_Tree
+//
+
+#ifndef Merge_Operator_hpp
+#define Merge_Operator_hpp
+
+#include <stdio.h>
+
+/*
+ Applies the operands written by Tree::merge to the value of a key
+ Operands are written without reading the value, they are folded together by the merges
+ and the lookups before the value under them is known, so the operation has to be associative;
+ a key without a value takes its operands folded together
+ */
+class MergeOperator{
+public:
+    virtual ~MergeOperator(){};
+    //the value once the operand is applied to it
+    virtual int combine(int value, int operand) const = 0;
+};
+
+class AddOperator : public MergeOperator{
+public:
+    int combine(int value, int operand) const;
+};
+
+class MaxOperator : public MergeOperator{
+public:
+    int combine(int value, int operand) const;
+};
+
+class MinOperator : public MergeOperator{
+public:
+    int combine(int value, int operand) const;
+};
+
+#endif /* Merge_Operator_hpp */
@@ -0,0 +1,129 @@
+//
+//  Page_Search.cpp
+//  LSM_Tree
+//
+
+#include "Page_Search.hpp"
+#include "LSM.hpp"
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PAGE_SEARCH_AVX2
+#include <immintrin.h>
+#endif
+
+//the keys are gathered out of the KVpairs, an int apart
+static_assert(offsetof(KVpair, key) == 0 && sizeof(KVpair) % sizeof(int) == 0, "KVpair layout");
+
+typedef unsigned long (*LowerBound)(const KVpair* page, unsigned long size, int key);
+
+/**
+ @return the index of the first entry whose key is not below the key, size when none
+ */
+static unsigned long lower_bound_scalar(const KVpair* page, unsigned long size, int key){
+    if(size == 0) return 0;
+    const KVpair* base = page;
+    unsigned long n = size;
+    //the answer stays within [base, base+n], the halving compiles to a conditional move
+    while(n > 1){
+        unsigned long half = n/2;
+        base = base[half].key < key ? base + half : base;
+        n -= half;
+    }
+    return (base - page) + (base->key < key);
+}
+
+#ifdef PAGE_SEARCH_AVX2
+/**
+ @return how many of the n (at most 8) entries from base have a key below the key
+ */
+__attribute__((target("avx2")))
+static inline int count_below_avx2(const KVpair* base, int n, int key){
+    const int stride = sizeof(KVpair)/sizeof(int);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i offsets = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(stride));
+    //the lanes past n are not loaded
+    __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes);
+    __m256i keys = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)base, offsets, valid, 4);
+    __m256i below = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(key), keys), valid);
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(below)));
+}
+
+__attribute__((target("avx2")))
+static unsigned long lower_bound_avx2(const KVpair* page, unsigned long size, int key){
+    const KVpair* base = page;
+    unsigned long n = size;
+    while(n > 16){
+        unsigned long half = n/2;
+        base = base[half].key < key ? base + half : base;
+        n -= half;
+    }
+    //the entries below the key are the ones before the answer
+    int below = count_below_avx2(base, (int)std::min(n, 8ul), key);
+    if(n > 8) below += count_below_avx2(base + 8, (int)n - 8, key);
+    return (base - page) + below;
+}
+
+static LowerBound pick_kernel(){
+    //the CPU features may not be read yet when called during static initialization
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? lower_bound_avx2 : lower_bound_scalar;
+}
+#else
+static LowerBound pick_kernel(){
+    return lower_bound_scalar;
+}
+#endif
+
+static unsigned long lower_bound_first(const KVpair* page, unsigned long size, int key);
+
+//picked at the first search, so a search made during static initialization finds it set;
+//atomic since the shard workers search at the same time, relaxed as any value is a whole kernel
+static std::atomic<LowerBound> lower_bound_kernel(lower_bound_first);
+
+/**
+ Pick the kernel, unless set_page_search_kernel has already set one
+ @return the kernel to search with
+ */
+static LowerBound pick_once(){
+    LowerBound expected = lower_bound_first;
+    LowerBound picked = pick_kernel();
+    if(lower_bound_kernel.compare_exchange_strong(expected, picked, std::memory_order_relaxed)) return picked;
+    return expected;
+}
+
+static unsigned long lower_bound_first(const KVpair* page, unsigned long size, int key){
+    return pick_once()(page, size, key);
+}
+
+unsigned long page_lower_bound(const KVpair* page, unsigned long size, int key){
+    return lower_bound_kernel.load(std::memory_order_relaxed)(page, size, key);
+}
+
+PageSearchKernel page_search_kernel(){
+    LowerBound kernel = lower_bound_kernel.load(std::memory_order_relaxed);
+    if(kernel == lower_bound_first) kernel = pick_once();
+    return kernel == lower_bound_scalar ? KERNEL_SCALAR : KERNEL_AVX2;
+}
+
+/**
+ Switch kernels, to compare them
+ Single-threaded only: no other thread may search while the kernel changes, the searches
+ in flight would run with either kernel
+ @return false when the CPU can't run the kernel
+ */
+bool set_page_search_kernel(PageSearchKernel kernel){
+    if(kernel == KERNEL_SCALAR){
+        lower_bound_kernel.store(lower_bound_scalar, std::memory_order_relaxed);
+        return true;
+    }
+#ifdef PAGE_SEARCH_AVX2
+    if(__builtin_cpu_supports("avx2")){
+        lower_bound_kernel.store(lower_bound_avx2, std::memory_order_relaxed);
+        return true;
+    }
+#endif
+    return false;
+}
@@ -0,0 +1,29 @@
+//
+//  Page_Search.hpp
+//  LSM_Tree
+//
+
+#ifndef Page_Search_hpp
+#define Page_Search_hpp
+
+#include <stdio.h>
+
+struct KVpair;
+
+enum PageSearchKernel{
+    //branch-free binary search
+    KERNEL_SCALAR = 0,
+    //branch-free binary search down to 16 entries, whose keys are then gathered and compared 8 at a time
+    KERNEL_AVX2 = 1
+};
+
+/*
+ Searches within pages read from a run, sorted by key
+ The kernel is picked at the first search from what the CPU supports, any thread can search;
+ set_page_search_kernel is for single-threaded benchmarks, with no search running
+ */
+unsigned long page_lower_bound(const KVpair* page, unsigned long size, int key);
+PageSearchKernel page_search_kernel();
+bool set_page_search_kernel(PageSearchKernel kernel);
+
+#endif /* Page_Search_hpp */
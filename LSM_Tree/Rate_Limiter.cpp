@@ -0,0 +1,70 @@
+//
+//  Rate_Limiter.cpp
+//  LSM_Tree
+//
+
+#include "Rate_Limiter.hpp"
+#include <algorithm>
+
+using namespace std::chrono;
+
+RateLimiter::RateLimiter(unsigned long bytes_per_second){
+    rate = std::max(bytes_per_second, 1ul);
+    last = steady_clock::now();
+    tokens = burst();
+}
+
+void RateLimiter::set_rate(unsigned long bytes_per_second){
+    std::lock_guard<std::mutex> guard(lock);
+    refill();
+    rate = std::max(bytes_per_second, 1ul);
+}
+
+/**
+ Multiply the rate while the levels fall behind, 1 for the configured rate
+ */
+void RateLimiter::set_boost(double factor){
+    std::lock_guard<std::mutex> guard(lock);
+    refill();
+    boost = std::max(factor, 1.0);
+    refilled.notify_all();
+}
+
+double RateLimiter::burst(){
+    return rate*boost/10;
+}
+
+void RateLimiter::refill(){
+    steady_clock::time_point now = steady_clock::now();
+    tokens = std::min(burst(), tokens + rate*boost*duration_cast<microseconds>(now - last).count()/1e6);
+    last = now;
+}
+
+/**
+ Wait until size bytes may be written
+ A request larger than the bucket is granted a bucket at a time
+ */
+void RateLimiter::request(unsigned long size, IOPriority priority){
+    steady_clock::time_point start = steady_clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    bytes[priority] += size;
+    double left = size;
+    if(priority == PRIORITY_FLUSH) flushes_waiting += 1;
+    while(left > 0){
+        refill();
+        double need = std::min(left, burst());
+        if(tokens >= need && (priority == PRIORITY_FLUSH || flushes_waiting == 0)){
+            tokens -= need;
+            left -= need;
+            continue;
+        }
+        //sleep until the missing tokens are in, or until a flush is done or the rate is boosted
+        double missing = std::max(need - tokens, 1.0);
+        refilled.wait_for(guard, microseconds((long)(missing*1e6/(rate*boost)) + 1));
+    }
+    if(priority == PRIORITY_FLUSH){
+        flushes_waiting -= 1;
+        refilled.notify_all();
+    }
+    waited[priority] += duration_cast<microseconds>(steady_clock::now() - start).count();
+}
@@ -0,0 +1,48 @@
+//
+//  Rate_Limiter.hpp
+//  LSM_Tree
+//
+
+#ifndef Rate_Limiter_hpp
+#define Rate_Limiter_hpp
+
+#include <stdio.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+enum IOPriority{
+    //writing the buffer out, the writes of the tree wait on it
+    PRIORITY_FLUSH = 0,
+    //merging levels
+    PRIORITY_COMPACTION = 1
+};
+
+/*
+ Token bucket shared by the flushes and the merges, so that their writes leave
+ the disk to the lookups
+ Tokens are bytes, they come in at the rate times the boost and pile up to a tenth of
+ a second's worth; a compaction waits as long as a flush is waiting
+ */
+class RateLimiter{
+    std::mutex lock;
+    std::condition_variable refilled;
+    double rate;
+    double boost = 1;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last;
+    int flushes_waiting = 0;
+    double burst();
+    void refill();
+
+public:
+    //bytes granted and microseconds waited, for each priority
+    unsigned long bytes[2] = {0, 0};
+    unsigned long waited[2] = {0, 0};
+    RateLimiter(unsigned long bytes_per_second);
+    void set_rate(unsigned long bytes_per_second);
+    void set_boost(double factor);
+    void request(unsigned long size, IOPriority priority);
+};
+
+#endif /* Rate_Limiter_hpp */
@@ -0,0 +1,144 @@
+//
+//  Row_Cache.cpp
+//  LSM_Tree
+//
+
+#include "Row_Cache.hpp"
+
+/**
+ FrequencySketch
+ */
+
+FrequencySketch::FrequencySketch(unsigned long int capacity){
+    width = 16;
+    while(width < capacity) width *= 2;
+    counters.assign(4*width, 0);
+    sample_size = 10*width;
+}
+
+unsigned long int FrequencySketch::index(int key, int row){
+    uint64_t h = ((uint64_t)(uint32_t)key + (row+1)*0x9E3779B97F4A7C15ULL)*0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+    return row*width + (h & (width-1));
+}
+
+void FrequencySketch::increment(int key){
+    for(int row = 0; row < 4; row++){
+        uint8_t& c = counters[index(key, row)];
+        if(c < 15) c += 1;
+    }
+    additions += 1;
+    if(additions >= sample_size){
+        for(unsigned long int i = 0; i < counters.size(); i++){
+            counters[i] /= 2;
+        }
+        additions /= 2;
+    }
+}
+
+/**
+ @return the smallest counter of the key, never below its real count before aging
+ */
+unsigned int FrequencySketch::estimate(int key){
+    unsigned int result = 15;
+    for(int row = 0; row < 4; row++){
+        unsigned int c = counters[index(key, row)];
+        if(c < result) result = c;
+    }
+    return result;
+}
+
+/**
+ @return the bytes of the counters
+ */
+unsigned long FrequencySketch::size_in_bytes(){
+    return counters.capacity();
+}
+
+/**
+ RowCache
+ */
+
+RowCache::RowCache(unsigned long int capacity): sketch(capacity){
+    this->capacity = capacity;
+}
+
+/**
+ Look up a key, every lookup counts towards the key's popularity
+ @param value stores the cached value
+ found stores whether the key exists, deleted keys are cached too
+ @return true on a hit
+ */
+bool RowCache::get(int key, int& value, bool& found){
+    sketch.increment(key);
+    auto it = index.find(key);
+    if(it == index.end()){
+        misses += 1;
+        return false;
+    }
+    hits += 1;
+    rows.splice(rows.begin(), rows, it->second);
+    value = it->second->value;
+    found = it->second->found;
+    return true;
+}
+
+/**
+ Offer the result of a lookup that went to the levels
+ */
+void RowCache::admit(int key, int value, bool found){
+    if(capacity == 0) return;
+    auto it = index.find(key);
+    if(it != index.end()){
+        it->second->value = value;
+        it->second->found = found;
+        rows.splice(rows.begin(), rows, it->second);
+        return;
+    }
+    if(rows.size() >= capacity){
+        //keep the victim unless the new key is more popular
+        Row& victim = rows.back();
+        if(sketch.estimate(key) <= sketch.estimate(victim.key)) return;
+        index.erase(victim.key);
+        rows.pop_back();
+    }
+    Row row;
+    row.key = key;
+    row.value = value;
+    row.found = found;
+    rows.push_front(row);
+    index[key] = rows.begin();
+}
+
+/**
+ Drop the cached value of a key that was written
+ */
+void RowCache::invalidate(int key){
+    auto it = index.find(key);
+    if(it == index.end()) return;
+    rows.erase(it->second);
+    index.erase(it);
+}
+
+/**
+ Drop the cached values of the keys in [low, high)
+ */
+void RowCache::invalidate_range(int low, int high){
+    for(auto it = rows.begin(); it != rows.end();){
+        if(it->key >= low && it->key < high){
+            index.erase(it->key);
+            it = rows.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+/**
+ @return the memory of the rows with their list and hash nodes, and of the sketch
+ */
+unsigned long RowCache::size_in_bytes(){
+    unsigned long row_node = sizeof(Row) + 2*sizeof(void*);
+    unsigned long index_node = sizeof(std::pair<const int, std::list<Row>::iterator>) + sizeof(void*);
+    return rows.size()*(row_node + index_node) + index.bucket_count()*sizeof(void*) + sketch.size_in_bytes();
+}
@@ -0,0 +1,61 @@
+//
+//  Row_Cache.hpp
+//  LSM_Tree
+//
+
+#ifndef Row_Cache_hpp
+#define Row_Cache_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+/*
+ Count-min sketch of how often keys are looked up, with 4 bit counters in 4 rows
+ All the counters are halved after a sample of lookups, so old popularity fades
+ */
+class FrequencySketch{
+    std::vector<uint8_t> counters;
+    unsigned long int width;
+    unsigned long int sample_size;
+    unsigned long int additions = 0;
+    unsigned long int index(int key, int row);
+
+public:
+    FrequencySketch(unsigned long int capacity);
+    void increment(int key);
+    unsigned int estimate(int key);
+    unsigned long size_in_bytes();
+};
+
+/*
+ Bounded cache of the latest value of the keys read from the levels
+ A key read from a full cache only replaces the least recently used key
+ when the sketch has seen it more often (TinyLFU admission)
+ reference: TinyLFU: A Highly Efficient Cache Admission Policy (Einziger et al., ACM ToS 2017)
+ */
+class RowCache{
+    struct Row{
+        int key;
+        int value;
+        bool found;
+    };
+    unsigned long int capacity;
+    std::list<Row> rows;
+    std::unordered_map<int, std::list<Row>::iterator> index;
+    FrequencySketch sketch;
+
+public:
+    unsigned long int hits = 0;
+    unsigned long int misses = 0;
+    RowCache(unsigned long int capacity);
+    bool get(int key, int& value, bool& found);
+    void admit(int key, int value, bool found);
+    void invalidate(int key);
+    void invalidate_range(int low, int high);
+    unsigned long size_in_bytes();
+};
+
+#endif /* Row_Cache_hpp */
@@ -0,0 +1,380 @@
+//
+//  Server.cpp
+//  LSM_Tree
+//
+
+#include "Server.hpp"
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+int open_socket(const std::string& address, bool listening){
+    int fd = -1;
+    if(address.compare(0, 5, "unix:") == 0){
+        std::string path = address.substr(5);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) return -1;
+        if(listening){
+            unlink(path.c_str());
+            if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0){
+                close(fd);
+                return -1;
+            }
+        }else if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    size_t colon = address.rfind(':');
+    if(colon == std::string::npos) return -1;
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon+1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    struct addrinfo* result;
+    if(getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+    for(struct addrinfo* a = result; a != NULL; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd < 0) continue;
+        int one = 1;
+        //responses are small, send them right away
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(listening){
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 128) == 0) break;
+        }else if(connect(fd, a->ai_addr, a->ai_addrlen) == 0){
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/*
+ Bytes read from a connection per round, and bytes of responses pending on it past which
+ it is not read from anymore
+ */
+static const unsigned long BUFFER_CAP = 1 << 20;
+
+static void set_nonblocking(int fd){
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/**
+ @param tree owned by the caller
+ address "unix:<path>" or "<host>:<port>"
+ */
+Server::Server(Tree* tree, const std::string& address){
+    this->tree = tree;
+    this->address = address;
+    running = false;
+}
+
+Server::~Server(){
+    for(auto const& x : connections){
+        close(x.first);
+        delete x.second;
+    }
+    if(listener >= 0) close(listener);
+    if(events_fd >= 0) close(events_fd);
+}
+
+/**
+ Register interest in a socket, writes are watched only while a response is pending
+ and reads only while the pending responses are under the cap
+ poll builds its set from the connections on every round, nothing to register
+ */
+void Server::watch(int fd, bool reading, bool writing, bool added){
+#ifdef __linux__
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (reading ? (uint32_t)EPOLLIN : 0u) | (writing ? (uint32_t)EPOLLOUT : 0u);
+    event.data.fd = fd;
+    epoll_ctl(events_fd, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+#endif
+}
+
+/**
+ Watch writes while a response is blocked, and stop reading while the pending responses
+ are over the cap
+ */
+void Server::update_watch(Connection* c, bool writing){
+    bool reading = c->out.size() - c->sent < BUFFER_CAP;
+    if(writing == c->writing && reading == c->reading) return;
+    c->writing = writing;
+    c->reading = reading;
+    watch(c->fd, reading, writing, true);
+}
+
+/**
+ Wait for the sockets that can be read or written, for at most 100 milliseconds
+ so that stop is noticed
+ */
+void Server::wait_events(std::vector<int>& readable, std::vector<int>& writable){
+#ifdef __linux__
+    struct epoll_event events[256];
+    int n = epoll_wait(events_fd, events, 256, 100);
+    for(int i = 0; i < n; i++){
+        if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readable.push_back(events[i].data.fd);
+        if(events[i].events & EPOLLOUT) writable.push_back(events[i].data.fd);
+    }
+#else
+    std::vector<struct pollfd> fds;
+    struct pollfd p;
+    p.fd = listener;
+    p.events = POLLIN;
+    fds.push_back(p);
+    for(auto const& x : connections){
+        p.fd = x.first;
+        p.events = (x.second->reading ? POLLIN : 0) | (x.second->writing ? POLLOUT : 0);
+        fds.push_back(p);
+    }
+    if(poll(fds.data(), fds.size(), 100) <= 0) return;
+    for(int i = 0; i < fds.size(); i++){
+        if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) readable.push_back(fds[i].fd);
+        if(fds[i].revents & POLLOUT) writable.push_back(fds[i].fd);
+    }
+#endif
+}
+
+void Server::accept_all(){
+    while(true){
+        int fd = accept(listener, NULL, NULL);
+        if(fd < 0) return;
+        set_nonblocking(fd);
+        Connection* c = new Connection;
+        c->fd = fd;
+        connections[fd] = c;
+        watch(fd, true, false, false);
+    }
+}
+
+/**
+ Read what has arrived, up to the cap; the rest stays in the socket for the next round
+ */
+void Server::read_all(Connection* c){
+    char chunk[65536];
+    while(c->in.size() < BUFFER_CAP){
+        ssize_t n = recv(c->fd, chunk, sizeof(chunk), 0);
+        if(n > 0){
+            c->in.insert(c->in.end(), chunk, chunk+n);
+        }else{
+            if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) c->closed = true;
+            if(n == 0 || errno != EINTR) return;
+        }
+    }
+}
+
+void Server::write_all(Connection* c){
+    while(c->sent < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data()+c->sent, c->out.size()-c->sent, 0);
+        if(n > 0){
+            c->sent += n;
+        }else if(errno == EAGAIN || errno == EWOULDBLOCK){
+            //the rest goes out when the socket becomes writable
+            update_watch(c, true);
+            return;
+        }else if(errno != EINTR){
+            c->closed = true;
+            return;
+        }
+    }
+    c->out.clear();
+    c->sent = 0;
+    update_watch(c, false);
+}
+
+void Server::close_connection(Connection* c){
+    //closing the socket also removes it from epoll
+    close(c->fd);
+    connections.erase(c->fd);
+    delete c;
+}
+
+static void add_response(std::vector<char>& out, int32_t status, int32_t value){
+    Response response;
+    response.status = status;
+    response.value = value;
+    const char* bytes = (const char*)&response;
+    out.insert(out.end(), bytes, bytes+sizeof(Response));
+}
+
+/**
+ Apply the complete requests of the connections in the order they arrived,
+ runs of consecutive lookups go to the tree as one batch
+ */
+void Server::dispatch(std::vector<Connection*>& ready){
+    std::vector<Connection*> owners;
+    std::vector<Request> requests;
+    for(int i = 0; i < ready.size(); i++){
+        Connection* c = ready[i];
+        unsigned long n = c->in.size()/sizeof(Request);
+        for(unsigned long j = 0; j < n; j++){
+            Request request;
+            memcpy(&request, c->in.data()+j*sizeof(Request), sizeof(Request));
+            owners.push_back(c);
+            requests.push_back(request);
+        }
+        c->in.erase(c->in.begin(), c->in.begin()+n*sizeof(Request));
+    }
+    std::vector<int> keys;
+    std::vector<int> values;
+    std::vector<bool> found;
+    unsigned long i = 0;
+    while(i < requests.size()){
+        Request& request = requests[i];
+        std::vector<char>& out = owners[i]->out;
+        switch (request.type) {
+            case REQ_GET:{
+                unsigned long j = i;
+                keys.clear();
+                while(j < requests.size() && requests[j].type == REQ_GET){
+                    keys.push_back(requests[j].key);
+                    j++;
+                }
+                tree->get_batch(keys, values, found);
+                for(unsigned long k = i; k < j; k++){
+                    add_response(owners[k]->out, found[k-i] ? 1 : 0, found[k-i] ? values[k-i] : 0);
+                }
+                i = j;
+                continue;
+            }
+            case REQ_PUT:
+                tree->put(request.key, request.value);
+                add_response(out, 1, 0);
+                break;
+            case REQ_DEL:
+                tree->del(request.key);
+                add_response(out, 1, 0);
+                break;
+            case REQ_RANGE:{
+                std::vector<KVpair> res = tree->range(request.key, request.value);
+                add_response(out, 1, (int32_t)res.size());
+                for(int k = 0; k < res.size(); k++){
+                    int32_t pair[2] = {res[k].key, res[k].value};
+                    out.insert(out.end(), (const char*)pair, (const char*)pair+sizeof(pair));
+                }
+                break;
+            }
+            case REQ_DEL_RANGE:
+                tree->del_range(request.key, request.value);
+                add_response(out, 1, 0);
+                break;
+            default:
+                add_response(out, 0, 0);
+                break;
+        }
+        i++;
+    }
+    for(int k = 0; k < ready.size(); k++){
+        if(!ready[k]->closed) write_all(ready[k]);
+    }
+}
+
+/**
+ Serve until stop is called
+ @return false when the address cannot be listened on
+ */
+bool Server::run(){
+    //a client going away shows up as a failed send instead
+    signal(SIGPIPE, SIG_IGN);
+    listener = open_socket(address, true);
+    if(listener < 0){
+        std::cout << "cannot listen on " << address << std::endl;
+        return false;
+    }
+    set_nonblocking(listener);
+#ifdef __linux__
+    events_fd = epoll_create1(0);
+#endif
+    watch(listener, true, false, false);
+    running = true;
+    std::vector<int> readable;
+    std::vector<int> writable;
+    std::vector<Connection*> ready;
+    while(running){
+        readable.clear();
+        writable.clear();
+        ready.clear();
+        wait_events(readable, writable);
+        for(int i = 0; i < writable.size(); i++){
+            auto it = connections.find(writable[i]);
+            if(it != connections.end()) write_all(it->second);
+        }
+        for(int i = 0; i < readable.size(); i++){
+            if(readable[i] == listener){
+                accept_all();
+                continue;
+            }
+            auto it = connections.find(readable[i]);
+            //a hang up is noticed by the pending write failing
+            if(it == connections.end() || !it->second->reading) continue;
+            read_all(it->second);
+            if(it->second->in.size() >= sizeof(Request)) ready.push_back(it->second);
+        }
+        dispatch(ready);
+        std::vector<Connection*> closed;
+        for(auto const& x : connections){
+            if(x.second->closed) closed.push_back(x.second);
+        }
+        for(int i = 0; i < closed.size(); i++){
+            close_connection(closed[i]);
+        }
+    }
+    return true;
+}
+
+void Server::stop(){
+    running = false;
+}
+
+/**
+ Serve a new tree until the process is stopped, its lookups go through an I/O backend
+ so that the gets dispatched together are read together
+ @param address "unix:<path>" or "<host>:<port>"
+ backend "sync", "threadpool" or "io_uring", io_uring falls back to the thread pool
+ queue_depth the reads the backend keeps in flight
+ @return the exit status of the process
+ */
+int serve(const std::string& address, const std::string& backend, int queue_depth){
+    IOBackendType type;
+    if(!parse_io_backend(backend, type)){
+        std::cout << "unknown I/O backend " << backend << std::endl;
+        return 1;
+    }
+    IOBackend* io = create_io_backend(type, std::max(queue_depth, 1));
+    bool ok;
+    {
+        Tree tree;
+        tree.set_io_backend(io);
+        Server server(&tree, address);
+        ok = server.run();
+    }
+    delete io;
+    return ok ? 0 : 1;
+}
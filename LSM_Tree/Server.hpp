@@ -0,0 +1,94 @@
+//
+//  Server.hpp
+//  LSM_Tree
+//
+
+#ifndef Server_hpp
+#define Server_hpp
+
+#include <stdio.h>
+#include "Tree.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+
+/*
+ Wire protocol, in host byte order since the server is meant for local clients
+ Every request is a fixed size record; a client can send many requests before
+ reading the responses, which come back in the same order
+ */
+enum RequestType{
+    REQ_PUT = 1,
+    REQ_GET = 2,
+    REQ_DEL = 3,
+    //key is the low bound, value the high bound
+    REQ_RANGE = 4,
+    REQ_DEL_RANGE = 5
+};
+
+struct Request{
+    int32_t type;
+    int32_t key;
+    int32_t value;
+};
+
+/*
+ status is 1 on success or when a get found the key, 0 otherwise
+ A range response is followed by value pairs of key and value
+ */
+struct Response{
+    int32_t status;
+    int32_t value;
+};
+
+/*
+ @param address "unix:<path>" for a unix socket, "<host>:<port>" for TCP
+ @return the socket, -1 on error
+ */
+int open_socket(const std::string& address, bool listening);
+
+/*
+ Single threaded server over a tree, driven by an event loop
+ (epoll on Linux, poll elsewhere)
+ The requests read from all the connections in one round are dispatched
+ together, so consecutive lookups are answered by one batched lookup
+ A connection whose responses pile up past a cap is not read from until its
+ client catches up, so a client that pipelines without reading can't grow the buffers
+ */
+class Server{
+    struct Connection{
+        int fd;
+        std::vector<char> in;
+        std::vector<char> out;
+        unsigned long sent = 0;
+        bool writing = false;
+        bool reading = true;
+        bool closed = false;
+    };
+    Tree* tree;
+    std::string address;
+    int listener = -1;
+    int events_fd = -1;
+    std::unordered_map<int, Connection*> connections;
+    std::atomic<bool> running;
+    void watch(int fd, bool reading, bool writing, bool added);
+    void update_watch(Connection* c, bool writing);
+    void wait_events(std::vector<int>& readable, std::vector<int>& writable);
+    void accept_all();
+    void read_all(Connection* c);
+    void write_all(Connection* c);
+    void close_connection(Connection* c);
+    void dispatch(std::vector<Connection*>& ready);
+
+public:
+    Server(Tree* tree, const std::string& address);
+    ~Server();
+    bool run();
+    void stop();
+};
+
+int serve(const std::string& address, const std::string& backend, int queue_depth);
+
+#endif /* Server_hpp */
@@ -0,0 +1,22 @@
+//
+//  Server_Main.cpp
+//  LSM_Tree
+//
+
+#include "Server.hpp"
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+/*
+ Entry point of the LSM_Server target, a server without the benchmarks of LSM_Tree
+ LSM_Server <address> [sync|threadpool|io_uring] [queue depth]
+ address is "unix:<path>" or "<host>:<port>", the lookups go through io_uring by default
+ */
+int main(int argc, const char * argv[]) {
+    if(argc < 2){
+        std::cout << "usage: LSM_Server <address> [sync|threadpool|io_uring] [queue depth]" << std::endl;
+        return 1;
+    }
+    return serve(argv[1], argc > 2 ? argv[2] : "io_uring", argc > 3 ? atoi(argv[3]) : 32);
+}
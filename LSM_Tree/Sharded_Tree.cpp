@@ -0,0 +1,240 @@
+//
+//  Sharded_Tree.cpp
+//  LSM_Tree
+//
+
+#include "Sharded_Tree.hpp"
+#include <algorithm>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ @param num_shards number of trees the keys are spread over
+ opts the options of every tree, the data directory and the level directories are replaced
+ by a subdirectory for the shard
+ data_dir directory holding one subdirectory per shard, empty for the working directory
+ workers when true, each shard applies its batches on its own thread
+ pin when true, the worker of shard i runs on core i modulo the number of cores, Linux only
+ */
+ShardedTree::ShardedTree(unsigned int num_shards, const Options& opts, const std::string& data_dir, bool workers, bool pin){
+    this->workers = workers;
+    if(!data_dir.empty()){
+        mkdir(data_dir.c_str(), 0755);
+    }
+    unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    //one tracer for every shard: a thread records to one ring whichever shard it works on
+    SharedResources shared;
+    if(opts.trace_events > 0){
+        tracer = shared.tracer = new EventTracer(opts.trace_events);
+    }
+    for(unsigned int i = 0; i < std::max(num_shards, 1u); i++){
+        Options shard_options = opts;
+        shard_options.data_dir = (data_dir.empty() ? "" : data_dir + "/") + "shard_" + std::to_string(i);
+        //every level directory gets a subdirectory per shard too
+        for(int j = 0; j < opts.level_dirs.size(); j++){
+            if(i == 0 && !opts.level_dirs[j].empty()) mkdir(opts.level_dirs[j].c_str(), 0755);
+            //an empty entry stays empty so the level falls back to the shard's data_dir
+            if(!opts.level_dirs[j].empty()) shard_options.level_dirs[j] = opts.level_dirs[j] + "/shard_" + std::to_string(i);
+        }
+        Shard* shard = new Shard;
+        shard->tree = new Tree(shard_options, shared);
+        if(workers){
+            shard->worker = std::thread(&ShardedTree::work, this, shard);
+#ifdef __linux__
+            if(pin){
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(i%cores, &cpus);
+                pthread_setaffinity_np(shard->worker.native_handle(), sizeof(cpu_set_t), &cpus);
+            }
+#endif
+        }
+        shards.push_back(shard);
+    }
+}
+
+ShardedTree::~ShardedTree(){
+    for(int i = 0; i < shards.size(); i++){
+        if(workers){
+            {
+                std::lock_guard<std::mutex> guard(shards[i]->queue_lock);
+                shards[i]->stop = true;
+            }
+            shards[i]->ready.notify_one();
+            shards[i]->worker.join();
+        }
+        delete shards[i]->tree;
+        delete shards[i];
+    }
+    delete tracer;
+}
+
+unsigned int ShardedTree::num_shards(){
+    return shards.size();
+}
+
+/**
+ @return the tracer the trees of all the shards record to, NULL when the options don't trace
+ */
+EventTracer* ShardedTree::get_event_tracer(){
+    return tracer;
+}
+
+/**
+ Multiplicative hashing spreads consecutive keys over the shards,
+ the high bits of the hash pick the shard
+ */
+unsigned int ShardedTree::shard_of(int key){
+    unsigned long hash = (unsigned int)key*2654435761u;
+    return (unsigned int)((hash*shards.size()) >> 32);
+}
+
+/**
+ Worker loop of a shard, runs until the shard is stopped and its queue is empty
+ */
+void ShardedTree::work(Shard* shard){
+    std::unique_lock<std::mutex> guard(shard->queue_lock);
+    while(true){
+        shard->ready.wait(guard, [shard]{return shard->stop || !shard->queue.empty();});
+        if(shard->queue.empty()) return;
+        std::vector<Operation>* batch = shard->queue.front();
+        shard->queue.pop_front();
+        shard->busy = true;
+        guard.unlock();
+        apply(shard, *batch);
+        guard.lock();
+        shard->busy = false;
+        if(shard->queue.empty()) shard->idle.notify_all();
+    }
+}
+
+void ShardedTree::apply(Shard* shard, std::vector<Operation>& batch){
+    std::lock_guard<std::mutex> guard(shard->lock);
+    for(int i = 0; i < batch.size(); i++){
+        Operation& op = batch[i];
+        switch (op.type) {
+            case OP_PUT:
+                shard->tree->put(op.key, op.value);
+                break;
+            case OP_GET:
+                op.found = shard->tree->get(op.key, op.value);
+                break;
+            case OP_DEL:
+                shard->tree->del(op.key);
+                break;
+        }
+    }
+}
+
+void ShardedTree::put(int key, int value){
+    Shard* shard = shards[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    shard->tree->put(key, value);
+}
+
+bool ShardedTree::merge(int key, int operand){
+    Shard* shard = shards[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    return shard->tree->merge(key, operand);
+}
+
+bool ShardedTree::get(int key, int& value){
+    Shard* shard = shards[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    return shard->tree->get(key, value);
+}
+
+void ShardedTree::del(int key){
+    Shard* shard = shards[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    shard->tree->del(key);
+}
+
+/**
+ delete all the keys within the range, on every shard
+ @params low : include
+ high : not include
+ */
+void ShardedTree::del_range(int low, int high){
+    for(int i = 0; i < shards.size(); i++){
+        std::lock_guard<std::mutex> guard(shards[i]->lock);
+        shards[i]->tree->del_range(low, high);
+    }
+}
+
+/**
+ return the key value pairs within the range from every shard, sorted by key
+ @params low : include
+ high : not include
+ */
+std::vector<KVpair> ShardedTree::range(int low, int high){
+    std::vector<KVpair> result;
+    for(int i = 0; i < shards.size(); i++){
+        std::vector<KVpair> part;
+        {
+            std::lock_guard<std::mutex> guard(shards[i]->lock);
+            part = shards[i]->tree->range(low, high);
+        }
+        result.insert(result.end(), part.begin(), part.end());
+    }
+    //the shards hold disjoint keys, sorting is enough to merge them
+    std::sort(result.begin(), result.end(), compareKVpair);
+    return result;
+}
+
+/**
+ Apply a batch of operations to a shard, every key of the batch must belong to the shard
+ With workers the batch is queued and applied on the worker of the shard,
+ otherwise it is applied right away
+
+ @param batch owned by the caller, kept alive until wait returns for the shard
+ */
+void ShardedTree::submit(unsigned int shard, std::vector<Operation>* batch){
+    Shard* s = shards.at(shard);
+    if(!workers){
+        apply(s, *batch);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(s->queue_lock);
+        s->queue.push_back(batch);
+    }
+    s->ready.notify_one();
+}
+
+/**
+ Block until every batch submitted to the shard has been applied
+ */
+void ShardedTree::wait(unsigned int shard){
+    Shard* s = shards.at(shard);
+    std::unique_lock<std::mutex> guard(s->queue_lock);
+    s->idle.wait(guard, [s]{return s->queue.empty() && !s->busy;});
+}
+
+/**
+ Split a batch of operations by shard, apply the parts in parallel when there
+ are workers, and store the results of the gets back in the batch
+ The operations of a shard are applied in the order of the batch
+ */
+void ShardedTree::apply_batch(std::vector<Operation>& batch){
+    std::vector<std::vector<Operation>> parts(shards.size());
+    std::vector<std::vector<int>> positions(shards.size());
+    for(int i = 0; i < batch.size(); i++){
+        unsigned int s = shard_of(batch[i].key);
+        parts[s].push_back(batch[i]);
+        positions[s].push_back(i);
+    }
+    for(unsigned int s = 0; s < shards.size(); s++){
+        if(!parts[s].empty()) submit(s, &parts[s]);
+    }
+    for(unsigned int s = 0; s < shards.size(); s++){
+        if(parts[s].empty()) continue;
+        wait(s);
+        for(int j = 0; j < parts[s].size(); j++){
+            batch[positions[s][j]] = parts[s][j];
+        }
+    }
+}
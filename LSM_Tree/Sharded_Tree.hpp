@@ -0,0 +1,77 @@
+//
+//  Sharded_Tree.hpp
+//  LSM_Tree
+//
+
+#ifndef Sharded_Tree_hpp
+#define Sharded_Tree_hpp
+
+#include <stdio.h>
+#include "Tree.hpp"
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum OperationType{
+    OP_PUT,
+    OP_GET,
+    OP_DEL
+};
+
+/*
+ One operation of a batch, a get stores its result in value and found
+ */
+struct Operation{
+    OperationType type;
+    int key;
+    int value = 0;
+    bool found = false;
+};
+
+/*
+ Front end that hash-partitions the keys across independent trees
+ Each shard has its own data directory and, optionally, a worker thread that
+ applies the batches submitted to the shard, so writes to different shards
+ use different cores without any structure of a tree being shared
+ */
+class ShardedTree{
+    struct Shard{
+        Tree* tree;
+        //held while the tree is in use
+        std::mutex lock;
+        std::thread worker;
+        std::mutex queue_lock;
+        std::condition_variable ready;
+        std::condition_variable idle;
+        std::deque<std::vector<Operation>*> queue;
+        bool busy = false;
+        bool stop = false;
+    };
+    std::vector<Shard*> shards;
+    bool workers;
+    //shared by the trees of the shards, so their events export together
+    EventTracer* tracer = NULL;
+    void work(Shard* shard);
+    void apply(Shard* shard, std::vector<Operation>& batch);
+
+public:
+    ShardedTree(unsigned int num_shards, const Options& opts, const std::string& data_dir, bool workers = false, bool pin = false);
+    ~ShardedTree();
+    unsigned int num_shards();
+    unsigned int shard_of(int key);
+    EventTracer* get_event_tracer();
+    void put(int key, int value);
+    bool merge(int key, int operand);
+    bool get(int key, int& value);
+    void del(int key);
+    void del_range(int low, int high);
+    std::vector<KVpair> range(int low, int high);
+    void submit(unsigned int shard, std::vector<Operation>* batch);
+    void wait(unsigned int shard);
+    void apply_batch(std::vector<Operation>& batch);
+};
+
+#endif /* Sharded_Tree_hpp */
@@ -0,0 +1,167 @@
+//
+//  Trace.cpp
+//  LSM_Tree
+//
+
+#include "Trace.hpp"
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std::chrono;
+
+/**
+ Convert a text workload of "p key value", "g key", "d key" and "r low high" lines to a binary trace
+
+ @return false when the text file can't be read or holds an unknown operation
+ */
+bool convert_trace(const std::string& text_file, const std::string& trace_file){
+    std::ifstream input(text_file);
+    if(!input.is_open()) return false;
+    std::vector<char> records;
+    char action;
+    uint64_t count = 0;
+    while(input >> action){
+        int32_t operands[2] = {0, 0};
+        if(action == TRACE_PUT || action == TRACE_RANGE){
+            input >> operands[0] >> operands[1];
+        }else if(action == TRACE_GET || action == TRACE_DEL){
+            input >> operands[0];
+        }else{
+            std::cout << "Unknown operation " << action << std::endl;
+            return false;
+        }
+        if(input.fail()) return false;
+        records.push_back(action);
+        records.insert(records.end(), (char*)operands, (char*)operands + sizeof(operands));
+        count += 1;
+    }
+    std::ofstream output(trace_file, std::ios::binary);
+    output.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    output.write((char*)&TRACE_VERSION, sizeof(TRACE_VERSION));
+    output.write((char*)&count, sizeof(count));
+    output.write(records.data(), records.size());
+    return output.good();
+}
+
+/**
+ Map a binary trace and decode all of its records, so that replaying it does no parsing
+
+ @param operations stores the operations of the trace, in order
+ @return false when the file is not a valid trace
+ */
+bool load_trace(const std::string& trace_file, std::vector<TraceOperation>& operations){
+    int fd = open(trace_file.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < TRACE_HEADER_SIZE){
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) return false;
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    const char* data = (const char*)mapped;
+    uint32_t version;
+    uint64_t count;
+    memcpy(&version, data + 4, sizeof(version));
+    memcpy(&count, data + 8, sizeof(count));
+    bool ok = memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && version == TRACE_VERSION
+    && st.st_size == TRACE_HEADER_SIZE + count*TRACE_RECORD_SIZE;
+    if(ok){
+        operations.resize(count);
+        const char* record = data + TRACE_HEADER_SIZE;
+        for(uint64_t i = 0; i < count; i++, record += TRACE_RECORD_SIZE){
+            operations[i].op = record[0];
+            memcpy(&operations[i].key, record + 1, sizeof(int32_t));
+            memcpy(&operations[i].value, record + 5, sizeof(int32_t));
+        }
+    }
+    munmap(mapped, st.st_size);
+    return ok;
+}
+
+/*
+ Apply an operation to a tree, either a Tree or a ShardedTree
+ */
+template <class T>
+void replay_operation(T* tree, const TraceOperation& operation, ReplayResult& result){
+    if(operation.op == TRACE_PUT){
+        tree->put(operation.key, operation.value);
+    }else if(operation.op == TRACE_GET){
+        int value;
+        if(tree->get(operation.key, value)) result.found += 1;
+    }else if(operation.op == TRACE_DEL){
+        tree->del(operation.key);
+    }else if(operation.op == TRACE_RANGE){
+        result.range_pairs += tree->range(operation.key, operation.value).size();
+    }
+    result.operations += 1;
+}
+
+/**
+ Replay a decoded trace on one thread, only the calls to the tree are timed
+ */
+ReplayResult replay_trace(Tree* tree, const std::vector<TraceOperation>& operations){
+    ReplayResult result;
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    for(unsigned long i = 0; i < operations.size(); i++){
+        replay_operation(tree, operations[i], result);
+    }
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    result.microseconds = duration_cast<microseconds>(t2 - t1).count();
+    return result;
+}
+
+/**
+ Replay a decoded trace from several threads, at most one per shard
+ The operations are partitioned by the shard of their key and each thread replays its part in
+ the trace's order, so every key sees its operations in order and the gets find what they did
+ on one thread; the ranges all go to the first thread and, spanning the shards, may see the
+ writes of the other threads earlier or later than in the trace
+ The threads are started before the clock and wait for each other, so only the calls are timed
+ */
+ReplayResult replay_trace(ShardedTree* tree, const std::vector<TraceOperation>& operations, int threads){
+    threads = std::max(std::min(threads, (int)tree->num_shards()), 1);
+    std::vector<std::vector<unsigned long>> parts(threads);
+    for(unsigned long i = 0; i < operations.size(); i++){
+        int t = operations[i].op == TRACE_RANGE ? 0 : tree->shard_of(operations[i].key) % threads;
+        parts[t].push_back(i);
+    }
+    std::vector<ReplayResult> results(threads);
+    std::vector<std::thread> workers;
+    std::atomic<int> ready(0);
+    std::atomic<bool> start(false);
+    for(int t = 0; t < threads; t++){
+        workers.push_back(std::thread([&, t]{
+            ready += 1;
+            while(!start) std::this_thread::yield();
+            for(unsigned long i = 0; i < parts[t].size(); i++){
+                replay_operation(tree, operations[parts[t][i]], results[t]);
+            }
+        }));
+    }
+    while(ready < threads) std::this_thread::yield();
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    start = true;
+    for(int t = 0; t < threads; t++){
+        workers[t].join();
+    }
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    ReplayResult result;
+    for(int t = 0; t < threads; t++){
+        result.operations += results[t].operations;
+        result.found += results[t].found;
+        result.range_pairs += results[t].range_pairs;
+    }
+    result.microseconds = duration_cast<microseconds>(t2 - t1).count();
+    return result;
+}
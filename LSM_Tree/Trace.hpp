@@ -0,0 +1,57 @@
+//
+//  Trace.hpp
+//  LSM_Tree
+//
+
+#ifndef Trace_hpp
+#define Trace_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Tree.hpp"
+#include "Sharded_Tree.hpp"
+
+/*
+ Binary trace format, in host byte order:
+ a header of the magic "LSMT", the version (uint32) and the number of operations (uint64),
+ then one record of 9 bytes per operation: the operation as in the text workloads
+ ('p', 'g', 'd' or 'r'), then two int32, key and value, or low and high for a range
+ */
+const char TRACE_MAGIC[4] = {'L', 'S', 'M', 'T'};
+const uint32_t TRACE_VERSION = 1;
+const unsigned long TRACE_HEADER_SIZE = 16;
+const unsigned long TRACE_RECORD_SIZE = 9;
+
+enum TraceOp{
+    TRACE_PUT = 'p',
+    TRACE_GET = 'g',
+    TRACE_DEL = 'd',
+    //key is the low bound, value the high bound
+    TRACE_RANGE = 'r'
+};
+
+struct TraceOperation{
+    char op;
+    int key;
+    int value;
+};
+
+/*
+ What a replay did, the results are counted so that no call can be left out
+ */
+struct ReplayResult{
+    unsigned long operations = 0;
+    unsigned long found = 0;
+    unsigned long range_pairs = 0;
+    //time spent in the calls to the tree only
+    long microseconds = 0;
+};
+
+bool convert_trace(const std::string& text_file, const std::string& trace_file);
+bool load_trace(const std::string& trace_file, std::vector<TraceOperation>& operations);
+ReplayResult replay_trace(Tree* tree, const std::vector<TraceOperation>& operations);
+ReplayResult replay_trace(ShardedTree* tree, const std::vector<TraceOperation>& operations, int threads);
+
+#endif /* Trace_hpp */
@@ -8,13 +8,173 @@
 
 #include "Tree.hpp"
 #include "LSM.hpp"
+#include "Engine.hpp"
+#include "Checkpoint.hpp"
 #include <cmath>
+#include <algorithm>
+#include <fstream>
 #include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
 
-Tree::Tree(){
-    Layer layer;
-    layer.set_rank(0);
-    layers.push_back(layer);
+Tree::Tree(): Tree(Options()){
+}
+
+Tree::Tree(const Options& opts): Tree(opts, SharedResources()){
+}
+
+Tree::Tree(const Options& opts, const SharedResources& shared): options(opts), buffer(opts.buffer_capacity){
+    if(!options.data_dir.empty()){
+        //the directory may already exist
+        mkdir(options.data_dir.c_str(), 0755);
+    }
+    for(int i = 0; i < options.level_dirs.size(); i++){
+        if(!options.level_dirs[i].empty()) mkdir(options.level_dirs[i].c_str(), 0755);
+    }
+    engine = shared.engine;
+    memory = shared.memory;
+    if(memory == NULL){
+        memory = owned.memory = new MemoryTracker(options.memory_limit);
+    }
+    fence_cache = shared.fence_cache;
+    if(fence_cache == NULL && options.fence_cache_bytes > 0){
+        fence_cache = owned.fence_cache = new FenceCache(options.fence_cache_bytes, memory);
+    }
+    rate_limiter = shared.rate_limiter;
+    if(rate_limiter == NULL && options.rate_limit > 0){
+        rate_limiter = owned.rate_limiter = new RateLimiter(options.rate_limit);
+    }
+    tracer = shared.tracer;
+    if(tracer == NULL && options.trace_events > 0){
+        tracer = owned.tracer = new EventTracer(options.trace_events);
+    }
+    add_layer();
+    merge_io = shared.merge_io;
+    if(merge_io == NULL){
+        //two workers are enough for one read-ahead and one write-behind at a time
+        merge_io = owned.merge_io = create_io_backend(IO_THREADPOOL, 2);
+    }
+    if(options.row_cache_entries > 0){
+        row_cache = new RowCache(options.row_cache_entries);
+    }
+}
+
+Tree::~Tree(){
+    //the indexes leave the fence cache before it goes, it may outlive the tree
+    for(int i = 0; i < layers.size(); i++){
+        layers[i].release();
+    }
+    for(int i = 0; i < NUM_MEMORY_COMPONENTS; i++){
+        memory->charge((MemoryComponent)i, -memory_charged[i]);
+    }
+    delete owned.merge_io;
+    delete tuner;
+    delete row_cache;
+    delete owned.fence_cache;
+    delete owned.rate_limiter;
+    delete owned.tracer;
+    delete owned.memory;
+}
+
+const Options& Tree::get_options(){
+    return options;
+}
+
+/**
+ @return the limiter of the flushes and merges, NULL without a rate limit
+ */
+const RateLimiter* Tree::get_rate_limiter(){
+    return rate_limiter;
+}
+
+/**
+ @return the tracer of the flushes, merges and slow operations, NULL when the options don't trace
+ */
+EventTracer* Tree::get_event_tracer(){
+    return tracer;
+}
+
+/**
+ @return the tracker of the memory the tree holds, shared with the other keyspaces of an engine
+ */
+MemoryTracker* Tree::get_memory_tracker(){
+    account_memory();
+    return memory;
+}
+
+/**
+ Charge the memory tracker with what the buffer, the filters, the indexes and the row cache
+ hold now; done after every flush, the fence cache and the merges charge it themselves
+ */
+void Tree::account_memory(){
+    long bytes[NUM_MEMORY_COMPONENTS] = {0};
+    bytes[MEMORY_BUFFERS] = buffer.allocated_bytes();
+    for(int i = 0; i < layers.size(); i++){
+        unsigned long filters, indexes;
+        layers[i].memory_usage(filters, indexes);
+        bytes[MEMORY_FILTERS] += filters;
+        bytes[MEMORY_INDEXES] += indexes;
+    }
+    if(row_cache != NULL) bytes[MEMORY_CACHES] = row_cache->size_in_bytes();
+    for(int i = 0; i < NUM_MEMORY_COMPONENTS; i++){
+        memory->charge((MemoryComponent)i, bytes[i] - memory_charged[i]);
+        memory_charged[i] = bytes[i];
+    }
+}
+
+/**
+ Let a tuner pick the size ratio, the buffer size and the bloom filter
+ false positive rates from the observed workload
+ 
+ @param window number of operations observed between two decisions
+ memory_budget bytes shared by the buffer and the bloom filters
+ */
+void Tree::enable_tuning(unsigned long window, unsigned long memory_budget){
+    delete tuner;
+    tuner = new Tuner(window, memory_budget);
+}
+
+/**
+ @return the number of entries in the tree, including old versions and tombstones
+ */
+unsigned long Tree::num_entries(){
+    unsigned long total = buffer.size;
+    for(int i = 0; i < layers.size(); i++){
+        for(int j = 0; j < layers.at(i).num_runs(); j++){
+            total += layers.at(i).get_run(j).size;
+        }
+    }
+    return total;
+}
+
+/**
+ @return the bytes of the writes waiting in the buffer
+ */
+unsigned long Tree::buffer_bytes(){
+    return buffer.size_in_bytes();
+}
+
+/**
+ Give back the memory of the buffer, once it is flushed
+ */
+void Tree::release_buffer(){
+    buffer.release();
+    account_memory();
+}
+
+/**
+ Charge the memory tracker with the growth of the buffer, and let the engine of the tree
+ keep the buffers of its keyspaces within its budget, which can flush this tree or another one
+ */
+void Tree::written(){
+    long bytes = buffer.allocated_bytes();
+    if(bytes != memory_charged[MEMORY_BUFFERS]){
+        memory->charge(MEMORY_BUFFERS, bytes - memory_charged[MEMORY_BUFFERS]);
+        memory_charged[MEMORY_BUFFERS] = bytes;
+    }
+    if(engine != NULL) engine->written(this);
 }
 
 /**
@@ -23,71 +183,359 @@ Tree::Tree(){
  @return when true, the first layer has reached its limit
  */
 bool Tree::bufferFlush(){
-    buffer.sort();
+    TraceSpan span(tracer, "buffer flush", "flush");
+    span.arg("entries", buffer.size);
+    span.arg("bytes", buffer.size*sizeof(KVpair));
+    buffer.compact(snapshots, options.merge_operator);
     return layers[0].add_run_from_buffer(buffer);
 }
 
 /**
  flush level in the LSM tree
+ Tombstones are dropped when the high layer is the last layer and holds no
+ older runs, since there is nothing left for them to shadow
  
  @param low layer to be flushed
- high layer to be flushed in
+ high layer to be flushed in, can be the low layer itself to compact it in place
  @return when true, the high layer has reached its limit
  */
 bool Tree::layerFlush(Layer &low, Layer &high){
-    int num_pointers = 0;
-    unsigned long size = 0;
-    BloomFilter *bf = NULL;
-    FencePointer *fp = NULL;
-    std::string new_run = low.merge(size, bf, fp, num_pointers);
-    return high.add_run(new_run, size, bf, fp, num_pointers);
+    Run new_run;
+    //the merge is behind when the level it goes to fills up with it and has to be merged next
+    if(rate_limiter != NULL){
+        rate_limiter->set_boost(&low != &high && high.num_sorted_runs() + 1 >= options.num_runs() ? options.rate_limit_boost : 1);
+    }
+    bool drop_tombstones = &high == &layers.back() && (&low == &high || high.num_runs() == 0);
+    //written straight into the directory of the high layer
+    new_run.name = high.get_temp_name();
+    //in place, the runs would be renamed over each other
+    bool disjoint = &low != &high && low.disjoint(drop_tombstones);
+    TraceSpan span(tracer, disjoint ? "concatenate" : "merge", "compaction");
+    unsigned long bytes_in = 0;
+    for(int i = 0; i < low.num_runs(); i++){
+        bytes_in += low.get_run(i).size*sizeof(KVpair);
+    }
+    span.arg("level", &low - layers.data());
+    span.arg("bytes_in", bytes_in);
+    if(disjoint){
+        //nothing to merge or write, the files of the runs move to the high layer end to end
+        std::vector<Run> segments;
+        low.concatenate(segments);
+        bool full = false;
+        for(int i = 0; i < segments.size(); i++){
+            full = high.add_run(segments[i]);
+        }
+        span.arg("bytes_out", 0);
+        return full;
+    }else if(!low.pagewise_merge(io != NULL ? io : merge_io, new_run, drop_tombstones, snapshots)){
+        span.arg("bytes_out", 0);
+        return false;
+    }
+    span.arg("bytes_out", new_run.size*sizeof(KVpair));
+    return high.add_run(new_run);
 };
 
-void Tree::flush(){
-    if(bufferFlush()){
-        int level = 0;
-        bool goOn = true;
-        while(goOn && level + 1 < layers.size()){
-            goOn = layerFlush(layers.at(level), layers.at(level+1));
-            level += 1;
+/**
+ Keep flushing levels down the tree, starting from a full level, until
+ a level has room left; add a new level at the bottom when needed
+ 
+ @param level the full level to start from
+ */
+void Tree::cascade(int level){
+    bool goOn = true;
+    while(goOn && level + 1 < layers.size()){
+        goOn = layerFlush(layers.at(level), layers.at(level+1));
+        level += 1;
+    }
+    if(goOn){
+        add_layer();
+        layerFlush(layers.at(level), layers.at(level+1));
+    }
+}
+
+/**
+ Add an empty level at the bottom of the tree
+ */
+void Tree::add_layer(){
+    Layer layer(&options);
+    layer.set_rank(layers.size());
+    layer.set_fence_cache(fence_cache);
+    layer.set_rate_limiter(rate_limiter);
+    layer.set_event_tracer(tracer);
+    layer.set_memory_tracker(memory);
+    layers.push_back(layer);
+}
+
+/**
+ Compact the first level whose tombstone fraction exceeds the tombstone threshold
+ The last level is merged in place, which drops its tombstones; any other level
+ is pushed down so its tombstones move towards the last level
+ */
+void Tree::compact_tombstones(){
+    for(int i = 0; i < layers.size(); i++){
+        if(layers.at(i).num_runs() == 0 || layers.at(i).tombstone_ratio() <= options.tombstone_threshold){
+            continue;
         }
-        if(goOn){
-            Layer layer;
-            layer.set_rank(layers.size());
-            layers.push_back(layer);
-            layerFlush(layers.at(level), layers.at(level+1));
+        if(i + 1 == layers.size()){
+            layerFlush(layers.at(i), layers.at(i));
+        }else if(layerFlush(layers.at(i), layers.at(i+1))){
+            cascade(i+1);
         }
+        return;
+    }
+}
+
+/**
+ Apply the options picked by the tuner
+ The buffer is empty right after a flush, so it can be resized; the new size ratio
+ and false positive rates take effect as levels fill up and merge
+ */
+void Tree::retune(){
+    if(tuner == NULL || !tuner->due()) return;
+    Options next = options;
+    if(tuner->tune(options, num_entries(), next)){
+        options = next;
+        buffer.set_capacity(options.buffer_capacity);
+    }
+}
+
+void Tree::flush(){
+    if(bufferFlush()){
+        cascade(0);
     }
+    compact_tombstones();
+    retune();
+    account_memory();
+}
+
+/**
+ Take a snapshot of the tree as it is now
+ @return the handle to read through, release it once with release_snapshot
+ */
+Snapshot Tree::snapshot(){
+    Snapshot s;
+    s.seq = sequence;
+    snapshots.insert(std::upper_bound(snapshots.begin(), snapshots.end(), s.seq), s.seq);
+    return s;
+}
+
+/**
+ Let the merges drop the versions only the snapshot was seeing
+ */
+void Tree::release_snapshot(const Snapshot& snapshot){
+    auto it = std::lower_bound(snapshots.begin(), snapshots.end(), snapshot.seq);
+    if(it != snapshots.end() && *it == snapshot.seq) snapshots.erase(it);
+}
 
+/**
+ Apply the operand to the value of the key with the merge operator of the options, without
+ reading the value; the operand is folded in by the merges and the lookups
+ @return false when the options have no merge operator
+ */
+bool Tree::merge(int key, int operand){
+    if(options.merge_operator == NULL) return false;
+    TraceSpan span(tracer, "merge", "slow operation", options.trace_slow_micros);
+    span.arg("key", key);
+    if(tuner != NULL) tuner->record_write();
+    sequence += 1;
+    if(row_cache != NULL) row_cache->invalidate(key);
+    if(buffer.merge(key, operand, sequence, options.merge_operator, snapshots)){
+        flush();
+    }
+    written();
+    return true;
 }
 
 void Tree::put(int key, int value){
-    if(buffer.put(key, value)){
+    TraceSpan span(tracer, "put", "slow operation", options.trace_slow_micros);
+    span.arg("key", key);
+    if(tuner != NULL) tuner->record_write();
+    sequence += 1;
+    if(row_cache != NULL) row_cache->invalidate(key);
+    if(buffer.put(key, value, sequence, snapshots)){
         flush();
     }
+    written();
 };
 
 bool Tree::get(int key, int& value){
-    switch (buffer.get(key, value)) {
-        case 1:
-            return true;
-        case -1:
-            return false;
-        default:
-            for(int i = 0; i < layers.size(); i++){
-                switch (layers.at(i).get(key, value)) {
-                    case 1:
-                        return true;
-                    case -1:
-                        return false;
-                    default:
-                        break;
-                }
-            }
+    Snapshot latest;
+    latest.seq = MAX_SEQ;
+    return get(key, value, latest);
+}
+
+/**
+ Point lookup as of the snapshot
+ With an I/O backend, the pages of every run that passes the filters are read together,
+ otherwise one at a time; either way into buffers of the thread, so a lookup makes no
+ heap allocation
+ */
+bool Tree::get(int key, int& value, const Snapshot& snapshot){
+    TraceSpan span(tracer, "get", "slow operation", options.trace_slow_micros);
+    span.arg("key", key);
+    if(tuner != NULL) tuner->record_get();
+    int c = buffer.get(key, value, snapshot.seq, options.merge_operator);
+    if(c == 1 || c == -1) return c == 1;
+    //the row cache only holds the latest versions, the operands of the buffer included
+    bool cached = row_cache != NULL && snapshot.seq == MAX_SEQ;
+    bool found = false;
+    if(cached && row_cache->get(key, value, found)) return found;
+    if(io != NULL){
+        c = read_levels(key, snapshot.seq, c, value);
+    }else{
+        for(int i = 0; i < layers.size() && (c == 0 || c == 2); i++){
+            int layer_value = 0;
+            int older = layers.at(i).get(key, layer_value, snapshot.seq);
+            c = apply_older(options.merge_operator, c, value, older, layer_value);
+        }
     }
-    return false;
+    //operands with nothing under them apply to nothing
+    found = c == 1 || c == 2;
+    if(cached) row_cache->admit(key, value, found);
+    return found;
 };
 
+/**
+ Read the candidate pages of the key in every level through the I/O backend at once,
+ the reads, requests and pages are kept by the thread and only grow
+ @param c the result of the buffer, 0 or 2 when operands wait for the older versions
+ value holds the operands of the buffer, stores the value found
+ @return 1:found, 0:not found, -1:deleted, 2:operands found
+ */
+int Tree::read_levels(int key, unsigned long snapshot, int c, int& value){
+    static thread_local std::vector<PageRead> reads;
+    static thread_local std::vector<IORequest> requests;
+    static thread_local std::vector<KVpair> pages;
+    reads.clear();
+    for(int i = 0; i < layers.size(); i++){
+        if(layers.at(i).collect_reads(key, snapshot, reads) == -1) break;
+    }
+    unsigned long total = 0;
+    for(int j = 0; j < reads.size(); j++){
+        total += reads[j].size;
+    }
+    if(pages.size() < total) pages.resize(total);
+    requests.resize(reads.size());
+    unsigned long offset = 0;
+    for(int j = 0; j < reads.size(); j++){
+        init_request(requests[j], reads[j].fd, false, reads[j].offset*sizeof(KVpair), reads[j].size*sizeof(KVpair), (char*)&pages[offset]);
+        offset += reads[j].size;
+    }
+    io->run_batch(requests);
+    //the first run holding a visible version has the newest one, operands go on to the older runs
+    offset = 0;
+    for(int j = 0; j < reads.size() && (c == 0 || c == 2); j++){
+        unsigned long size = requests[j].result < 0 ? 0 : requests[j].result/sizeof(KVpair);
+        int run_value = 0;
+        unsigned long seq = 0;
+        int older = search_page(&pages[offset], size, key, snapshot, reads[j].tombstone_seq, options.merge_operator, run_value, seq);
+        //a range tombstone of the same run hides the versions older than itself
+        if(older != 0 && seq < reads[j].tombstone_seq) older = -1;
+        c = apply_older(options.merge_operator, c, value, older, run_value);
+        offset += reads[j].size;
+    }
+    return c;
+}
+
+/**
+ Point lookups for several keys
+ With an I/O backend, the pages of every run that passes the filters are read
+ in one batch for all the keys, instead of one page at a time
+ 
+ @param keys the keys to look up
+ values stores the value of each key
+ found stores whether each key was found
+ */
+void Tree::get_batch(const std::vector<int>& keys, std::vector<int>& values, std::vector<bool>& found){
+    Snapshot latest;
+    latest.seq = MAX_SEQ;
+    get_batch(keys, values, found, latest);
+}
+
+void Tree::get_batch(const std::vector<int>& keys, std::vector<int>& values, std::vector<bool>& found, const Snapshot& snapshot){
+    TraceSpan span(tracer, "get batch", "slow operation", options.trace_slow_micros);
+    span.arg("keys", keys.size());
+    values.assign(keys.size(), 0);
+    found.assign(keys.size(), false);
+    if(io == NULL){
+        for(int i = 0; i < keys.size(); i++){
+            int value = 0;
+            found[i] = get(keys[i], value, snapshot);
+            values[i] = value;
+        }
+        return;
+    }
+    if(tuner != NULL) tuner->record_get(keys.size());
+    //collect the candidate pages of each key, from the newest to the oldest
+    std::vector<PageRead> reads;
+    std::vector<unsigned long> first_read(keys.size()+1, 0);
+    bool cached = row_cache != NULL && snapshot.seq == MAX_SEQ;
+    std::vector<bool> from_levels(keys.size(), false);
+    //the result of each key so far, 2 while operands of the buffer wait for the older versions
+    std::vector<int> results(keys.size(), 0);
+    for(int i = 0; i < keys.size(); i++){
+        first_read[i] = reads.size();
+        int value = 0;
+        int c = buffer.get(keys[i], value, snapshot.seq, options.merge_operator);
+        if(c == 1 || c == 2){
+            values[i] = value;
+            found[i] = true;
+        }
+        if(c == 1 || c == -1) continue;
+        results[i] = c;
+        bool exists = false;
+        if(cached && row_cache->get(keys[i], value, exists)){
+            values[i] = value;
+            found[i] = exists;
+            continue;
+        }
+        from_levels[i] = true;
+        for(int j = 0; j < layers.size(); j++){
+            if(layers.at(j).collect_reads(keys[i], snapshot.seq, reads) == -1) break;
+        }
+    }
+    first_read[keys.size()] = reads.size();
+    
+    //read all the pages together, the versions of a key can go on over several pages
+    std::vector<unsigned long> page_offsets(reads.size()+1, 0);
+    for(int j = 0; j < reads.size(); j++){
+        page_offsets[j+1] = page_offsets[j] + reads[j].size;
+    }
+    std::vector<KVpair> pages(page_offsets.back());
+    std::vector<IORequest> requests(reads.size());
+    for(int j = 0; j < reads.size(); j++){
+        init_request(requests[j], reads[j].fd, false, reads[j].offset*sizeof(KVpair), reads[j].size*sizeof(KVpair), (char*)&pages[page_offsets[j]]);
+    }
+    io->run_batch(requests);
+    
+    //the first run holding a visible version has the newest one, operands go on to the older runs
+    for(int i = 0; i < keys.size(); i++){
+        if(!from_levels[i]) continue;
+        int c = results[i];
+        int value = values[i];
+        for(unsigned long j = first_read[i]; j < first_read[i+1] && (c == 0 || c == 2); j++){
+            unsigned long size = requests[j].result < 0 ? 0 : requests[j].result/sizeof(KVpair);
+            int run_value = 0;
+            unsigned long seq = 0;
+            int older = search_page(&pages[page_offsets[j]], size, keys[i], snapshot.seq, reads[j].tombstone_seq, options.merge_operator, run_value, seq);
+            //a range tombstone of the same run hides the versions older than itself
+            if(older != 0 && seq < reads[j].tombstone_seq) older = -1;
+            c = apply_older(options.merge_operator, c, value, older, run_value);
+        }
+        found[i] = c == 1 || c == 2;
+        values[i] = found[i] ? value : 0;
+        if(cached && from_levels[i]) row_cache->admit(keys[i], values[i], found[i]);
+    }
+}
+
+/**
+ Set the backend used for point lookups and merges
+ @param backend owned by the caller, NULL reads the pages one at a time
+ and leaves the merges to the tree's own thread pool
+ */
+void Tree::set_io_backend(IOBackend* backend){
+    io = backend;
+}
 
 /**
  return the all the key value pairs within the range
@@ -96,25 +544,496 @@ bool Tree::get(int key, int& value){
  return vector of the key-value pair
  */
 std::vector<KVpair> Tree::range(int low, int high){
+    Snapshot latest;
+    latest.seq = MAX_SEQ;
+    return range(low, high, latest);
+}
+
+/**
+ Range query as of the snapshot, a long scan can be split into several range queries
+ through one snapshot and still see a single consistent state while writes go on
+ */
+std::vector<KVpair> Tree::range(int low, int high, const Snapshot& snapshot){
+    TraceSpan span(tracer, "range", "slow operation", options.trace_slow_micros);
+    span.arg("low", low);
+    span.arg("high", high);
+    if(tuner != NULL) tuner->record_range();
     std::unordered_map<int, KVpair> result_buffer;
-    buffer.range(low, high, result_buffer);
+    std::vector<RangeTombstone> range_deleted;
+    buffer.range(low, high, snapshot.seq, options.merge_operator, result_buffer, range_deleted);
     for(int i = 0; i < layers.size(); i++){
-        layers.at(i).range(low, high, result_buffer);
+        layers.at(i).range(low, high, snapshot.seq, result_buffer, range_deleted);
     }
     std::vector<KVpair> result;
     for (auto const& x : result_buffer)
     {
         KVpair kv = x.second;
         if(!kv.del){
+            //operands with nothing under them apply to nothing
+            kv.operand = false;
             result.push_back(kv);
         }
     }
     return result;
 };
 
+Aggregate Tree::aggregate(int low, int high){
+    Snapshot latest;
+    latest.seq = MAX_SEQ;
+    return aggregate(low, high, latest);
+}
+
+/**
+ Count, sum, min and max of the values of the keys within [low, high) as of the snapshot
+ The buffer and the runs are merged in key order, each key resolved to its newest version
+ as it comes, so nothing is materialized
+ A page is answered from its summary without being read when no other source has keys
+ within its fences, no newer range tombstone overlaps it and the snapshot sees all of it
+ */
+Aggregate Tree::aggregate(int low, int high, const Snapshot& snapshot){
+    TraceSpan span(tracer, "aggregate", "slow operation", options.trace_slow_micros);
+    span.arg("low", low);
+    span.arg("high", high);
+    if(tuner != NULL) tuner->record_range();
+    Aggregate result;
+    if(low >= high) return result;
+    //sources from the newest: the buffer, then the runs of each layer
+    std::vector<KVpair> entries;
+    for(int i = 0; i < buffer.size; i++){
+        if(buffer.data[i].key >= low && buffer.data[i].key < high) entries.push_back(buffer.data[i]);
+    }
+    std::sort(entries.begin(), entries.end(), compareKVpair);
+    std::vector<RangeCursor*> cursors;
+    std::vector<std::vector<RangeTombstone>> range_tombstones;
+    cursors.push_back(new RangeCursor(entries));
+    range_tombstones.push_back(buffer.range_tombstones);
+    for(int i = 0; i < layers.size(); i++){
+        for(int j = layers[i].num_runs()-1; j >= 0; j--){
+            const Run& run = layers[i].get_run(j);
+            cursors.push_back(new RangeCursor(run, options.kvpair_per_page, low, high));
+            range_tombstones.push_back(run.range_tombstones);
+        }
+    }
+    int num = cursors.size();
+    //keep the range tombstones the snapshot sees within the range
+    for(int i = 0; i < num; i++){
+        std::vector<RangeTombstone> visible;
+        for(int j = 0; j < range_tombstones[i].size(); j++){
+            const RangeTombstone& rt = range_tombstones[i][j];
+            if(rt.low < high && rt.high > low && rt.seq <= snapshot.seq) visible.push_back(rt);
+        }
+        range_tombstones[i].swap(visible);
+    }
+    //smallest key each source has left, a page not read yet counts from its fence pointer
+    enum {EXHAUSTED, ENTRY, UNREAD_PAGE};
+    std::vector<int> heads(num);
+    std::vector<int> states(num);
+    auto update = [&](int i){
+        if(cursors[i]->at_page_start()){
+            states[i] = UNREAD_PAGE;
+            heads[i] = cursors[i]->next_page().min;
+        }else if(cursors[i]->valid()){
+            states[i] = ENTRY;
+            heads[i] = cursors[i]->peek().key;
+        }else{
+            states[i] = EXHAUSTED;
+        }
+    };
+    auto summarizable = [&](int s){
+        const PageSummary* summary = cursors[s]->next_summary();
+        if(summary == NULL || !summary->clean || summary->max_seq > snapshot.seq) return false;
+        FencePointer fence = cursors[s]->next_page();
+        if(fence.min < low || fence.max >= high) return false;
+        for(int i = 0; i < num; i++){
+            if(i != s && states[i] != EXHAUSTED && heads[i] <= fence.max) return false;
+        }
+        //range tombstones of older sources are older than every entry of the page
+        for(int i = 0; i <= s; i++){
+            for(int j = 0; j < range_tombstones[i].size(); j++){
+                const RangeTombstone& rt = range_tombstones[i][j];
+                if(rt.low <= fence.max && rt.high > fence.min && (i < s || rt.seq > summary->min_seq)) return false;
+            }
+        }
+        return true;
+    };
+    for(int i = 0; i < num; i++){
+        update(i);
+    }
+    while(true){
+        int min_key = 0;
+        int min_source = -1;
+        for(int i = 0; i < num; i++){
+            if(states[i] != EXHAUSTED && (min_source < 0 || heads[i] < min_key || (heads[i] == min_key && states[i] == UNREAD_PAGE))){
+                min_key = heads[i];
+                min_source = i;
+            }
+        }
+        if(min_source < 0) break;
+        //a page can only be skipped when it comes first, otherwise it is read,
+        //its first key may come later than its fence
+        if(states[min_source] == UNREAD_PAGE){
+            if(summarizable(min_source)){
+                result.add(*cursors[min_source]->next_summary());
+                cursors[min_source]->skip_page();
+            }else{
+                cursors[min_source]->valid();
+            }
+            update(min_source);
+            continue;
+        }
+        //the newest version the snapshot sees, from the newest source that has one,
+        //with the older versions under it while it is an operand
+        int c = 0;
+        int value = 0;
+        for(int i = 0; i < num; i++){
+            if(states[i] != ENTRY || heads[i] != min_key) continue;
+            //the versions of a key may go on to the next page
+            while(!(cursors[i]->at_page_start() && cursors[i]->next_page().min > min_key) && cursors[i]->valid() && cursors[i]->peek().key == min_key){
+                const KVpair& version = cursors[i]->peek();
+                if((c == 0 || c == 2) && version.seq <= snapshot.seq){
+                    bool deleted = version.del;
+                    for(int j = 0; j <= i && !deleted; j++){
+                        deleted = covering_seq(range_tombstones[j], min_key, snapshot.seq) > version.seq;
+                    }
+                    c = apply_older(options.merge_operator, c, value, deleted ? -1 : (version.operand ? 2 : 1), version.value);
+                }
+                cursors[i]->next();
+            }
+            update(i);
+        }
+        if(c == 1 || c == 2) result.add(value);
+    }
+    for(int i = 0; i < num; i++){
+        delete cursors[i];
+    }
+    return result;
+}
+
 void Tree::del(int key){
-    if(buffer.del(key)){
+    TraceSpan span(tracer, "delete", "slow operation", options.trace_slow_micros);
+    span.arg("key", key);
+    if(tuner != NULL) tuner->record_write();
+    sequence += 1;
+    if(row_cache != NULL) row_cache->invalidate(key);
+    if(buffer.del(key, sequence, snapshots)){
         flush();
     }
+    written();
 };
 
+/**
+ delete all the keys within the range
+ @params low : include
+ high : not include
+ */
+void Tree::del_range(int low, int high){
+    if(low >= high) return;
+    TraceSpan span(tracer, "delete range", "slow operation", options.trace_slow_micros);
+    span.arg("low", low);
+    span.arg("high", high);
+    if(tuner != NULL) tuner->record_write();
+    sequence += 1;
+    if(row_cache != NULL) row_cache->invalidate_range(low, high);
+    if(buffer.del_range(low, high, sequence, snapshots)){
+        flush();
+    }
+    written();
+};
+
+/**
+ Apply the writes of the batch together
+ They take one sequence number, so that readers and snapshots see all of them or none,
+ and the buffer is flushed at most before and after the batch, never in the middle of it
+ @return false when the batch holds merges and the options have no merge operator,
+ nothing is written then
+ */
+bool Tree::write(const WriteBatch& batch){
+    if(batch.count() == 0) return true;
+    if(options.merge_operator == NULL && batch.has_merges()) return false;
+    TraceSpan span(tracer, "write batch", "slow operation", options.trace_slow_micros);
+    span.arg("writes", batch.count());
+    std::vector<KVpair> points;
+    std::vector<RangeTombstone> range_deletes;
+    batch.resolve(options.merge_operator, points, range_deletes);
+    if(tuner != NULL){
+        for(unsigned long i = 0; i < batch.count(); i++) tuner->record_write();
+    }
+    sequence += 1;
+    if(row_cache != NULL){
+        for(int i = 0; i < points.size(); i++) row_cache->invalidate(points[i].key);
+        for(int i = 0; i < range_deletes.size(); i++) row_cache->invalidate_range(range_deletes[i].low, range_deletes[i].high);
+    }
+    //make room first, so that the batch goes into one buffer
+    unsigned long used = buffer.size + buffer.range_tombstones.size();
+    if(used > 0 && used + points.size() + range_deletes.size() > buffer.capacity){
+        flush();
+    }
+    if(buffer.write(points, range_deletes, sequence, options.merge_operator, snapshots)){
+        flush();
+    }
+    written();
+    return true;
+}
+
+/**
+ Read up to max records of the bulk input, numbered in the order they come
+ @return the number of records read
+ */
+unsigned long read_records(std::istream& input, std::vector<KVpair>& records, unsigned long max, unsigned long& sequence){
+    records.clear();
+    int32_t pair[2];
+    while(records.size() < max && input.read((char*)pair, sizeof(pair))){
+        KVpair kv;
+        kv.key = pair[0];
+        kv.value = pair[1];
+        kv.del = false;
+        sequence += 1;
+        kv.seq = sequence;
+        records.push_back(kv);
+    }
+    return records.size();
+}
+
+/**
+ Load a dataset into an empty tree without going through the buffer and the merges
+ The input is sorted in pieces that fit the memory budget, the sorted pieces are merged
+ into a single run, which goes straight to the level runs of its size end up in
+ When a key appears several times, the last record wins
+ 
+ @param input records of two 32 bit integers, the key and the value
+ memory_budget bytes of records sorted at a time, at most half of what the memory limit leaves
+ sorted when true, the input is already sorted by key and is written as it comes
+ @return false when the tree is not empty or the input is not sorted as announced
+ */
+bool Tree::bulk_load(std::istream& input, unsigned long memory_budget, bool sorted){
+    if(buffer.size > 0 || !buffer.range_tombstones.empty()) return false;
+    for(int i = 0; i < layers.size(); i++){
+        if(layers.at(i).num_runs() > 0) return false;
+    }
+    IOBackend* backend = io != NULL ? io : merge_io;
+    unsigned long page_size = options.kvpair_per_page;
+    //the budget shrinks to what the memory limit leaves, the keys for the filter aside
+    memory_budget = std::min(memory_budget, memory->available()/2);
+    unsigned long chunk = std::max(memory_budget/sizeof(KVpair), page_size);
+    long reserved = chunk*sizeof(KVpair) + options.write_behind_pages*page_size*2*sizeof(KVpair);
+    memory->charge(MEMORY_MERGES, reserved);
+    Run run;
+    run.name = options.path("bulk_temp");
+    RunBuilder* builder = new RunBuilder(backend, run, &options);
+    std::vector<KVpair> records;
+    bool ok = true;
+    if(sorted){
+        //keep the last record of each key
+        KVpair pending;
+        bool has_pending = false;
+        while(ok && read_records(input, records, chunk, sequence) > 0){
+            for(int i = 0; i < records.size(); i++){
+                if(has_pending && records[i].key < pending.key){
+                    ok = false;
+                    break;
+                }
+                if(has_pending && records[i].key != pending.key) builder->add(pending);
+                pending = records[i];
+                has_pending = true;
+            }
+        }
+        if(ok && has_pending) builder->add(pending);
+    }else{
+        //sort the pieces, keeping the newest record of each key
+        std::vector<std::string> spills;
+        std::vector<unsigned long> spill_sizes;
+        while(read_records(input, records, chunk, sequence) > 0){
+            std::sort(records.begin(), records.end(), compareKVpair);
+            unsigned long kept = 0;
+            for(int i = 0; i < records.size(); i++){
+                if(kept == 0 || records[kept-1].key != records[i].key){
+                    records[kept] = records[i];
+                    kept += 1;
+                }
+            }
+            spills.push_back(options.path("bulk_" + std::to_string(spills.size())));
+            spill_sizes.push_back(kept);
+            std::ofstream spill(spills.back(), std::ios::binary);
+            spill.write((char*)records.data(), kept*sizeof(KVpair));
+            spill.close();
+        }
+        std::vector<KVpair>().swap(records);
+        //merge the pieces, the budget is shared by the read-ahead of every piece
+        unsigned long read_ahead = std::max(chunk/(2*(spills.size()+1)), page_size);
+        std::vector<RunReader*> readers(spills.size());
+        for(int i = 0; i < spills.size(); i++){
+            readers[i] = new RunReader(backend, spills[i], spill_sizes[i], read_ahead);
+        }
+        while(true){
+            int newest = -1;
+            for(int i = 0; i < readers.size(); i++){
+                if(!readers[i]->valid()) continue;
+                if(newest < 0 || readers[i]->peek().key < readers[newest]->peek().key ||
+                   (readers[i]->peek().key == readers[newest]->peek().key && readers[i]->peek().seq > readers[newest]->peek().seq)){
+                    newest = i;
+                }
+            }
+            if(newest < 0) break;
+            KVpair kv = readers[newest]->peek();
+            builder->add(kv);
+            for(int i = 0; i < readers.size(); i++){
+                if(readers[i]->valid() && readers[i]->peek().key == kv.key) readers[i]->next();
+            }
+        }
+        for(int i = 0; i < readers.size(); i++){
+            delete readers[i];
+            remove(spills[i].c_str());
+        }
+    }
+    //runs of level r hold about buffer_capacity*size_ratio^r entries
+    int rank = 0;
+    double run_size = options.buffer_capacity;
+    while(run_size < run.size){
+        run_size *= options.size_ratio;
+        rank += 1;
+    }
+    builder->finish(rank, tracer);
+    delete builder;
+    memory->charge(MEMORY_MERGES, -reserved);
+    if(!ok || run.size == 0){
+        delete run.filter;
+        delete run.index;
+        delete [] run.summaries;
+        remove(run.name.c_str());
+        return ok;
+    }
+    while(layers.size() <= rank){
+        add_layer();
+    }
+    layers.at(rank).add_run(run);
+    account_memory();
+    return true;
+}
+
+bool Tree::bulk_load(const std::string& file, unsigned long memory_budget, bool sorted){
+    std::ifstream input(file, std::ios::binary);
+    if(!input.is_open()) return false;
+    return bulk_load(input, memory_budget, sorted);
+}
+
+/**
+ Capture the tree as it is now in a directory, without copying the runs: the buffer is flushed,
+ every run file gets a hard link in the directory, and the metadata of the runs goes to the manifest
+ The MANIFEST is written last, under a temporary name first, so a directory without one
+ holds no complete checkpoint; on failure the links made so far are removed again
+ 
+ @param dir the directory of the checkpoint, on the file system of the runs for the links,
+ the files are copied otherwise
+ @return false when the directory holds a checkpoint already or can't be written
+ */
+bool Tree::checkpoint(const std::string& dir){
+    TraceSpan span(tracer, "checkpoint", "checkpoint");
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    std::string manifest = dir + "/MANIFEST";
+    if(access(manifest.c_str(), F_OK) == 0) return false;
+    //there is no log to keep the buffer in
+    if(buffer.size > 0 || !buffer.range_tombstones.empty()) flush();
+    std::ofstream out(manifest + ".temp", std::ios::binary);
+    uint64_t page_size = options.kvpair_per_page;
+    uint64_t seq = sequence;
+    uint32_t num_layers = layers.size();
+    out.write(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    out.write((char*)&MANIFEST_VERSION, sizeof(MANIFEST_VERSION));
+    out.write((char*)&page_size, sizeof(page_size));
+    out.write((char*)&seq, sizeof(seq));
+    out.write((char*)&num_layers, sizeof(num_layers));
+    std::vector<std::string> linked;
+    bool ok = true;
+    for(int i = 0; ok && i < layers.size(); i++){
+        uint32_t num_runs = layers[i].num_runs();
+        out.write((char*)&num_runs, sizeof(num_runs));
+        for(int j = 0; ok && j < num_runs; j++){
+            const Run& run = layers[i].get_run(j);
+            std::string file = base_name(run.name);
+            ok = link_file(run.name, dir + "/" + file);
+            if(!ok) break;
+            linked.push_back(dir + "/" + file);
+            write_run(out, run, file);
+        }
+    }
+    out.close();
+    span.arg("runs", linked.size());
+    if(ok && out.good() && rename((manifest + ".temp").c_str(), manifest.c_str()) == 0) return true;
+    //leave the directory as it was, so that a retry doesn't run into the links of this attempt
+    for(int i = 0; i < linked.size(); i++){
+        unlink(linked[i].c_str());
+    }
+    unlink((manifest + ".temp").c_str());
+    return false;
+}
+
+/**
+ Open a checkpoint in an empty tree: the run files are linked into the directories of
+ the levels and the metadata is read from the manifest, no run is read or rebuilt
+ The checkpoint stays as it is, the tree merges its own links away
+ 
+ @param dir a directory written by checkpoint
+ @return false when the tree is not empty, the checkpoint is incomplete, or its page size
+ differs from the options, the tree is left empty then
+ */
+bool Tree::restore(const std::string& dir){
+    if(buffer.size > 0 || !buffer.range_tombstones.empty()) return false;
+    for(int i = 0; i < layers.size(); i++){
+        if(layers.at(i).num_runs() > 0) return false;
+    }
+    std::ifstream in(dir + "/MANIFEST", std::ios::binary);
+    char magic[sizeof(MANIFEST_MAGIC)];
+    uint32_t version, num_layers;
+    uint64_t page_size, seq;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&page_size, sizeof(page_size));
+    in.read((char*)&seq, sizeof(seq));
+    in.read((char*)&num_layers, sizeof(num_layers));
+    if(!in || std::string(magic, sizeof(magic)) != std::string(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) ||
+       version != MANIFEST_VERSION || page_size != options.kvpair_per_page){
+        return false;
+    }
+    //read every run before linking any, so that a bad manifest leaves the tree as it was
+    std::vector<std::vector<Run>> levels(num_layers);
+    bool ok = true;
+    for(int i = 0; ok && i < num_layers; i++){
+        uint32_t num_runs = 0;
+        ok = in.read((char*)&num_runs, sizeof(num_runs)).good();
+        for(int j = 0; ok && j < num_runs; j++){
+            Run run;
+            ok = read_run(in, dir, run);
+            if(ok) levels[i].push_back(run);
+        }
+    }
+    for(int i = 0; ok && i < num_layers; i++){
+        for(int j = 0; ok && j < levels[i].size(); j++){
+            std::string temp = options.level_path(i, "run_restore_temp");
+            ok = link_file(levels[i][j].name, temp);
+            if(!ok) break;
+            levels[i][j].name = temp;
+            while(layers.size() <= i){
+                add_layer();
+            }
+            //renamed to the name of the run in the layer
+            layers[i].add_run(levels[i][j]);
+            levels[i][j] = Run();
+        }
+    }
+    for(int i = 0; i < num_layers; i++){
+        for(int j = 0; j < levels[i].size(); j++){
+            delete levels[i][j].filter;
+            delete levels[i][j].index;
+            delete [] levels[i][j].summaries;
+        }
+    }
+    if(!ok){
+        for(int i = 0; i < layers.size(); i++){
+            layers[i].reset();
+        }
+        return false;
+    }
+    sequence = std::max(sequence, (unsigned long)seq);
+    account_memory();
+    return true;
+}
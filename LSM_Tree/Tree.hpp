@@ -11,21 +11,102 @@
 
 #include <stdio.h>
 #include "LSM.hpp"
+#include "IO_Backend.hpp"
+#include "Tuner.hpp"
+#include "Row_Cache.hpp"
+#include "Write_Batch.hpp"
 #include <vector>
+#include <istream>
+
+/*
+ A consistent view of the tree: reads through a snapshot only see the writes
+ made before it was taken, merges keep the versions it sees until it is released
+ */
+struct Snapshot{
+    unsigned long seq;
+};
+
+class Engine;
+
+/*
+ What a tree shares with the other keyspaces of an engine, the engine owns it
+ The members left NULL are created by the tree for itself
+ */
+struct SharedResources{
+    //told about the writes, so that it keeps the buffers of its keyspaces within a budget
+    Engine* engine = NULL;
+    IOBackend* merge_io = NULL;
+    FenceCache* fence_cache = NULL;
+    RateLimiter* rate_limiter = NULL;
+    EventTracer* tracer = NULL;
+    MemoryTracker* memory = NULL;
+};
 
 class Tree{
+    Options options;
     Buffer buffer;
+    IOBackend* io = NULL;
+    IOBackend* merge_io;
+    Tuner* tuner = NULL;
+    RowCache* row_cache = NULL;
+    FenceCache* fence_cache = NULL;
+    RateLimiter* rate_limiter = NULL;
+    EventTracer* tracer = NULL;
+    MemoryTracker* memory = NULL;
+    //bytes of each component last charged to the memory tracker
+    long memory_charged[NUM_MEMORY_COMPONENTS] = {0};
+    Engine* engine = NULL;
+    //the resources the tree created, the shared ones are left to the engine
+    SharedResources owned;
+    //sequence number of the last write
+    unsigned long sequence = 0;
+    //sequence numbers of the live snapshots, sorted
+    std::vector<unsigned long> snapshots;
+    int read_levels(int key, unsigned long snapshot, int c, int& value);
 
 public:
     std::vector<Layer> layers;
     Tree();
+    Tree(const Options& opts);
+    Tree(const Options& opts, const SharedResources& shared);
+    ~Tree();
+    const Options& get_options();
+    const RateLimiter* get_rate_limiter();
+    EventTracer* get_event_tracer();
+    MemoryTracker* get_memory_tracker();
+    void account_memory();
+    void enable_tuning(unsigned long window, unsigned long memory_budget);
+    unsigned long num_entries();
+    unsigned long buffer_bytes();
+    void release_buffer();
+    void written();
     void flush();
     bool bufferFlush();
     bool layerFlush(Layer &low, Layer &high);
+    void cascade(int level);
+    void add_layer();
+    void compact_tombstones();
+    void retune();
+    Snapshot snapshot();
+    void release_snapshot(const Snapshot& snapshot);
     void put(int key, int value);
+    bool merge(int key, int operand);
     bool get(int key, int& value);
+    bool get(int key, int& value, const Snapshot& snapshot);
+    void get_batch(const std::vector<int>& keys, std::vector<int>& values, std::vector<bool>& found);
+    void get_batch(const std::vector<int>& keys, std::vector<int>& values, std::vector<bool>& found, const Snapshot& snapshot);
+    void set_io_backend(IOBackend* backend);
     void del(int key);
+    void del_range(int low, int high);
+    bool write(const WriteBatch& batch);
+    bool bulk_load(std::istream& input, unsigned long memory_budget, bool sorted = false);
+    bool bulk_load(const std::string& file, unsigned long memory_budget, bool sorted = false);
+    bool checkpoint(const std::string& dir);
+    bool restore(const std::string& dir);
     std::vector<KVpair> range(int low, int high);
+    std::vector<KVpair> range(int low, int high, const Snapshot& snapshot);
+    Aggregate aggregate(int low, int high);
+    Aggregate aggregate(int low, int high, const Snapshot& snapshot);
     
 };
 
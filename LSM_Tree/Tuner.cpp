@@ -0,0 +1,153 @@
+//
+//  Tuner.cpp
+//  LSM_Tree
+//
+
+#include "Tuner.hpp"
+#include <cmath>
+#include <algorithm>
+
+Tuner::Tuner(unsigned long window, unsigned long memory_budget){
+    this->window = window;
+    this->memory_budget = memory_budget;
+}
+
+void Tuner::record_get(unsigned long n){
+    gets += n;
+    since_last += n;
+}
+
+void Tuner::record_write(){
+    writes += 1;
+    since_last += 1;
+}
+
+void Tuner::record_range(){
+    ranges += 1;
+    since_last += 1;
+}
+
+/**
+ @return true when a whole window of operations has been observed since the last decision
+ */
+bool Tuner::due(){
+    return since_last >= window;
+}
+
+/**
+ Number of levels needed for the entries, level r holds up to size_ratio runs
+ of buffer_capacity*size_ratio^r entries
+ */
+int num_levels(unsigned int size_ratio, unsigned int buffer_capacity, unsigned long num_entries){
+    int levels = 0;
+    double level_capacity = buffer_capacity;
+    double total = 0;
+    while(total < num_entries){
+        level_capacity *= size_ratio;
+        total += level_capacity;
+        levels += 1;
+    }
+    return std::max(levels, 1);
+}
+
+/**
+ Number of bits the filters need when level r has the false positive rate fprate0*size_ratio^r
+ Levels at or above fp_threshold have no filter, the others use the filter type of the options
+ */
+double filter_bits_needed(unsigned int size_ratio, unsigned int buffer_capacity, unsigned long num_entries, double fprate0, const Options& current){
+    int levels = num_levels(size_ratio, buffer_capacity, num_entries);
+    double bits = 0;
+    double remaining = num_entries;
+    double level_capacity = buffer_capacity;
+    double fprate = fprate0;
+    for(int r = 0; r < levels && remaining > 0; r++){
+        level_capacity *= size_ratio;
+        double entries = std::min(level_capacity, remaining);
+        remaining -= entries;
+        if(fprate < current.fp_threshold){
+            bits += entries*filter_bits_per_key(current.filter_type(r), fprate);
+        }
+        fprate *= size_ratio;
+    }
+    return bits;
+}
+
+/**
+ Monkey allocation: the false positive rate grows by the size ratio at each level,
+ find the rate of the first level that uses up the memory given to the filters
+
+ @return the false positive rate of the first level
+ */
+double Tuner::filter_fprate0(unsigned int size_ratio, unsigned int buffer_capacity, unsigned long num_entries, double filter_bits, const Options& current){
+    double low = 1e-9;
+    double high = current.fp_threshold;
+    //the bits needed go down as the rate goes up, search on a log scale
+    for(int i = 0; i < 60; i++){
+        double mid = sqrt(low*high);
+        if(filter_bits_needed(size_ratio, buffer_capacity, num_entries, mid, current) > filter_bits){
+            low = mid;
+        }else{
+            high = mid;
+        }
+    }
+    return high;
+}
+
+/**
+ Expected I/Os per operation for the observed mix
+ point lookup: one false positive probe per run whose filter lets the key through
+ write: every entry is read and written once per level, a page at a time
+ range query: one page per run
+ */
+double Tuner::cost(unsigned int size_ratio, unsigned int buffer_capacity, double fprate0, unsigned long num_entries, const Options& current){
+    int levels = num_levels(size_ratio, buffer_capacity, num_entries);
+    double runs_per_level = size_ratio - 1;
+    double lookup = 0;
+    double fprate = fprate0;
+    for(int r = 0; r < levels; r++){
+        lookup += runs_per_level*(fprate < current.fp_threshold ? fprate : 1);
+        fprate *= size_ratio;
+    }
+    double write = 2.0*levels/current.kvpair_per_page;
+    double range = runs_per_level*levels;
+    double total = gets + writes + ranges;
+    if(total == 0) return lookup + write + range;
+    return (gets*lookup + writes*write + ranges*range)/total;
+}
+
+/**
+ Pick the options with the lowest cost for the operations observed so far
+ The memory budget is split between the buffer and the filters
+
+ @param current the options in use
+ num_entries the number of entries in the tree
+ next stores the picked options
+ @return true when the picked options differ from the current ones
+ */
+bool Tuner::tune(const Options& current, unsigned long num_entries, Options& next){
+    next = current;
+    double best = -1;
+    for(unsigned int size_ratio = 2; size_ratio <= 16; size_ratio++){
+        //the buffer is scanned on every write, keep it small enough for that
+        for(unsigned int buffer_capacity = 128; buffer_capacity <= 16384; buffer_capacity *= 2){
+            double buffer_bytes = buffer_capacity*sizeof(KVpair);
+            if(buffer_bytes >= memory_budget) break;
+            double filter_bits = (memory_budget - buffer_bytes)*8;
+            unsigned long entries = std::max(num_entries, (unsigned long)buffer_capacity*size_ratio);
+            double fprate0 = filter_fprate0(size_ratio, buffer_capacity, entries, filter_bits, current);
+            double c = cost(size_ratio, buffer_capacity, fprate0, entries, current);
+            if(best < 0 || c < best){
+                best = c;
+                next.size_ratio = size_ratio;
+                next.buffer_capacity = buffer_capacity;
+                next.fprate0 = fprate0;
+            }
+        }
+    }
+    //keep half of the history so the mix can drift
+    gets /= 2;
+    writes /= 2;
+    ranges /= 2;
+    since_last = 0;
+    return next.size_ratio != current.size_ratio || next.buffer_capacity != current.buffer_capacity || next.fprate0 != current.fprate0;
+}
@@ -0,0 +1,38 @@
+//
+//  Tuner.hpp
+//  LSM_Tree
+//
+
+#ifndef Tuner_hpp
+#define Tuner_hpp
+
+#include <stdio.h>
+#include "LSM.hpp"
+
+/*
+ Observes the mix of point lookups, writes and range queries, and picks the size ratio,
+ the buffer size and the filter false positive rates that minimize the expected
+ I/O cost per operation for that mix
+ reference: Monkey: Optimal Navigable Key-Value Store (Dayan et al., SIGMOD 2017)
+ Endure: A Robust Tuning Paradigm for LSM Trees Under Workload Uncertainty (Huynh et al., VLDB 2022)
+ */
+class Tuner{
+    unsigned long window;
+    unsigned long memory_budget;
+    unsigned long gets = 0;
+    unsigned long writes = 0;
+    unsigned long ranges = 0;
+    unsigned long since_last = 0;
+
+public:
+    Tuner(unsigned long window, unsigned long memory_budget);
+    void record_get(unsigned long n = 1);
+    void record_write();
+    void record_range();
+    bool due();
+    double filter_fprate0(unsigned int size_ratio, unsigned int buffer_capacity, unsigned long num_entries, double filter_bits, const Options& current);
+    double cost(unsigned int size_ratio, unsigned int buffer_capacity, double fprate0, unsigned long num_entries, const Options& current);
+    bool tune(const Options& current, unsigned long num_entries, Options& next);
+};
+
+#endif /* Tuner_hpp */
@@ -0,0 +1,128 @@
+//
+//  Write_Batch.cpp
+//  LSM_Tree
+//
+
+#include "Write_Batch.hpp"
+#include <algorithm>
+
+void WriteBatch::put(int key, int value){
+    writes.push_back({WRITE_PUT, key, value});
+}
+
+void WriteBatch::del(int key){
+    writes.push_back({WRITE_DEL, key, 0});
+}
+
+/**
+ Apply the operand with the merge operator of the tree, the batch is refused without one
+ */
+void WriteBatch::merge(int key, int operand){
+    writes.push_back({WRITE_MERGE, key, operand});
+}
+
+/**
+ delete all the keys within [low, high)
+ */
+void WriteBatch::del_range(int low, int high){
+    if(low >= high) return;
+    writes.push_back({WRITE_DEL_RANGE, low, high});
+}
+
+void WriteBatch::clear(){
+    writes.clear();
+}
+
+unsigned long WriteBatch::count() const{
+    return writes.size();
+}
+
+bool WriteBatch::has_merges() const{
+    for(int i = 0; i < writes.size(); i++){
+        if(writes[i].type == WRITE_MERGE) return true;
+    }
+    return false;
+}
+
+/**
+ @return true when a range delete between the two writes of the batch covers the key
+ */
+bool WriteBatch::covered(int key, unsigned long after, unsigned long before) const{
+    for(unsigned long i = after; i < before; i++){
+        if(writes[i].type == WRITE_DEL_RANGE && key >= writes[i].key && key < writes[i].value) return true;
+    }
+    return false;
+}
+
+/**
+ Reduce the batch to what it leaves behind, the writes of a key folded in the order they were added
+ A point write and a range tombstone of the batch get the same sequence number, and a tombstone
+ only hides older versions, so a point write a later range delete covers is left out, while
+ one written after the range delete stays
+ 
+ @param merge_operator folds the operands of a key together and into the value written before them
+ points stores one entry per key, sorted by key, a merge that meets no value of the batch stays an operand
+ range_deletes stores the range deletes
+ */
+void WriteBatch::resolve(const MergeOperator* merge_operator, std::vector<KVpair>& points, std::vector<RangeTombstone>& range_deletes) const{
+    points.clear();
+    range_deletes.clear();
+    std::vector<unsigned long> order;
+    bool ranges = false;
+    for(unsigned long i = 0; i < writes.size(); i++){
+        if(writes[i].type == WRITE_DEL_RANGE){
+            RangeTombstone rt;
+            rt.low = writes[i].key;
+            rt.high = writes[i].value;
+            rt.seq = 0;
+            range_deletes.push_back(rt);
+            ranges = true;
+        }else{
+            order.push_back(i);
+        }
+    }
+    //the writes of a key are next to each other, in the order they were added
+    std::stable_sort(order.begin(), order.end(), [this](unsigned long a, unsigned long b){
+        return writes[a].key < writes[b].key;
+    });
+    for(unsigned long i = 0; i < order.size();){
+        int key = writes[order[i]].key;
+        //nothing written yet: the older versions still show
+        bool written = false;
+        KVpair kv;
+        kv.key = key;
+        kv.value = 0;
+        kv.del = false;
+        kv.operand = false;
+        kv.seq = 0;
+        unsigned long last = 0;
+        for(; i < order.size() && writes[order[i]].key == key; i++){
+            const Write& w = writes[order[i]];
+            if(ranges && covered(key, last, order[i])){
+                //deleted, without a point tombstone since the range tombstone stays
+                written = false;
+                kv.del = true;
+                kv.operand = false;
+            }
+            last = order[i];
+            if(w.type == WRITE_PUT){
+                kv.value = w.value;
+                kv.del = false;
+                kv.operand = false;
+            }else if(w.type == WRITE_DEL){
+                kv.del = true;
+                kv.operand = false;
+            }else if(!written && !kv.del){
+                //an operand over the versions in the tree
+                kv.value = w.value;
+                kv.operand = true;
+            }else{
+                kv.value = kv.del ? w.value : merge_operator->combine(kv.value, w.value);
+                kv.del = false;
+            }
+            written = true;
+        }
+        if(ranges && covered(key, last, writes.size())) written = false;
+        if(written) points.push_back(kv);
+    }
+}
@@ -0,0 +1,47 @@
+//
+//  Write_Batch.hpp
+//  LSM_Tree
+//
+
+#ifndef Write_Batch_hpp
+#define Write_Batch_hpp
+
+#include <stdio.h>
+#include "LSM.hpp"
+#include <vector>
+
+enum WriteType{
+    WRITE_PUT,
+    WRITE_DEL,
+    WRITE_MERGE,
+    WRITE_DEL_RANGE
+};
+
+/*
+ Writes applied to a tree in one call by Tree::write
+ They share one sequence number, so a reader or a snapshot sees all of them or none,
+ and the buffer is checked for a flush once for the whole batch
+ Within the batch, the writes take effect in the order they were added
+ */
+class WriteBatch{
+    struct Write{
+        WriteType type;
+        int key;
+        //the value, the operand, or the end of a range
+        int value;
+    };
+    std::vector<Write> writes;
+    bool covered(int key, unsigned long after, unsigned long before) const;
+
+public:
+    void put(int key, int value);
+    void del(int key);
+    void merge(int key, int operand);
+    void del_range(int low, int high);
+    void clear();
+    unsigned long count() const;
+    bool has_merges() const;
+    void resolve(const MergeOperator* merge_operator, std::vector<KVpair>& points, std::vector<RangeTombstone>& range_deletes) const;
+};
+
+#endif /* Write_Batch_hpp */
@@ -0,0 +1,169 @@
+//
+//  Xor_Filter.cpp
+//  LSM_Tree
+//
+
+#include "Xor_Filter.hpp"
+#include <math.h>
+#include <algorithm>
+
+/*
+ Bits per fingerprint for the false positive rate: 2^-bits <= falsePosRate
+ */
+unsigned int XorFilter::fingerprint_bits(double falsePosRate){
+    int b = (int)ceil(log2(1/falsePosRate));
+    if(b < 1) b = 1;
+    if(b > 32) b = 32;
+    return b;
+}
+
+/*
+ The mixer of splitmix64, a bijection, so distinct keys never share a hash
+ */
+uint64_t XorFilter::hash(int x){
+    uint64_t h = (uint64_t)(uint32_t)x + seed*0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30))*0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27))*0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+/*
+ The slot of the key in the ith third of the table
+ */
+unsigned long int XorFilter::slot(uint64_t h, int i){
+    uint64_t r = i == 0 ? h : (h << (21*i)) | (h >> (64-21*i));
+    return ((uint64_t)(uint32_t)r*block_length >> 32) + i*block_length;
+}
+
+uint32_t XorFilter::fingerprint(uint64_t h){
+    return (uint32_t)(h ^ (h >> 32)) & (uint32_t)((1ULL << bits) - 1);
+}
+
+uint32_t XorFilter::get(unsigned long int i){
+    unsigned long int pos = i*bits;
+    uint64_t value = table[pos/64] >> (pos%64);
+    if(pos%64 + bits > 64) value |= table[pos/64+1] << (64 - pos%64);
+    return (uint32_t)value & (uint32_t)((1ULL << bits) - 1);
+}
+
+void XorFilter::set(unsigned long int i, uint32_t value){
+    unsigned long int pos = i*bits;
+    uint64_t mask = (1ULL << bits) - 1;
+    table[pos/64] = (table[pos/64] & ~(mask << (pos%64))) | ((uint64_t)value << (pos%64));
+    if(pos%64 + bits > 64){
+        int shift = 64 - pos%64;
+        table[pos/64+1] = (table[pos/64+1] & ~(mask >> shift)) | ((uint64_t)value >> shift);
+    }
+}
+
+/*
+ Build the filter by peeling: a slot only one key maps to can be given to that key,
+ which is removed from its other slots; when every key gets a slot, the slots are filled
+ in the reverse order so that each key's three slots xor to its fingerprint
+ Otherwise the keys are hashed again with another seed
+
+ @param keys the distinct keys of the run
+ */
+XorFilter::XorFilter(const std::vector<int>& keys, double falsePosRate){
+    bits = fingerprint_bits(falsePosRate);
+    unsigned long int n = keys.size();
+    unsigned long int capacity = 32 + (unsigned long int)ceil(1.23*n);
+    block_length = capacity/3;
+    capacity = 3*block_length;
+    table.assign((capacity*bits + 63)/64 + 1, 0);
+
+    std::vector<uint64_t> xormask(capacity);
+    std::vector<uint32_t> count(capacity);
+    std::vector<unsigned long int> queue;
+    std::vector<uint64_t> stack_hashes;
+    std::vector<unsigned long int> stack_slots;
+    while(true){
+        std::fill(xormask.begin(), xormask.end(), 0);
+        std::fill(count.begin(), count.end(), 0);
+        for(unsigned long int k = 0; k < n; k++){
+            uint64_t h = hash(keys[k]);
+            for(int i = 0; i < 3; i++){
+                unsigned long int s = slot(h, i);
+                xormask[s] ^= h;
+                count[s] += 1;
+            }
+        }
+        queue.clear();
+        for(unsigned long int s = 0; s < capacity; s++){
+            if(count[s] == 1) queue.push_back(s);
+        }
+        stack_hashes.clear();
+        stack_slots.clear();
+        while(!queue.empty()){
+            unsigned long int s = queue.back();
+            queue.pop_back();
+            if(count[s] != 1) continue;
+            uint64_t h = xormask[s];
+            stack_hashes.push_back(h);
+            stack_slots.push_back(s);
+            for(int i = 0; i < 3; i++){
+                unsigned long int t = slot(h, i);
+                xormask[t] ^= h;
+                count[t] -= 1;
+                if(count[t] == 1) queue.push_back(t);
+            }
+        }
+        if(stack_hashes.size() == n) break;
+        seed += 1;
+    }
+    for(long k = (long)n-1; k >= 0; k--){
+        uint64_t h = stack_hashes[k];
+        uint32_t value = fingerprint(h);
+        for(int i = 0; i < 3; i++){
+            unsigned long int t = slot(h, i);
+            if(t != stack_slots[k]) value ^= get(t);
+        }
+        set(stack_slots[k], value);
+    }
+}
+
+bool XorFilter::possiblyContains(int data){
+    uint64_t h = hash(data);
+    return fingerprint(h) == (get(slot(h, 0)) ^ get(slot(h, 1)) ^ get(slot(h, 2)));
+}
+
+unsigned long int XorFilter::size_in_bits(){
+    return 3*block_length*bits;
+}
+
+void XorFilter::write(std::ostream& out){
+    uint8_t format = FORMAT_XOR;
+    uint64_t length = block_length;
+    uint32_t b = bits;
+    uint64_t words = table.size();
+    out.write((char*)&format, sizeof(format));
+    out.write((char*)&seed, sizeof(seed));
+    out.write((char*)&length, sizeof(length));
+    out.write((char*)&b, sizeof(b));
+    out.write((char*)&words, sizeof(words));
+    out.write((char*)table.data(), words*sizeof(uint64_t));
+}
+
+/**
+ Read a filter written by write, after its tag
+ @return NULL when the input ends early
+ */
+XorFilter* XorFilter::read(std::istream& in){
+    uint64_t seed, length, words;
+    uint32_t b;
+    in.read((char*)&seed, sizeof(seed));
+    in.read((char*)&length, sizeof(length));
+    in.read((char*)&b, sizeof(b));
+    in.read((char*)&words, sizeof(words));
+    if(!in) return NULL;
+    XorFilter* filter = new XorFilter();
+    filter->seed = seed;
+    filter->block_length = length;
+    filter->bits = b;
+    filter->table.resize(words);
+    if(!in.read((char*)filter->table.data(), words*sizeof(uint64_t))){
+        delete filter;
+        return NULL;
+    }
+    return filter;
+}
@@ -0,0 +1,43 @@
+//
+//  Xor_Filter.hpp
+//  LSM_Tree
+//
+
+#ifndef Xor_Filter_hpp
+#define Xor_Filter_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "Filter.hpp"
+
+/*
+ Static xor filter, built once from all the keys of a run
+ A key is mapped to three slots, one in each third of the table, and the xor of the
+ three slots is its fingerprint; with b bits per fingerprint the false positive rate is 2^-b,
+ for about 1.23*b bits per key
+ reference: Xor Filters: Faster and Smaller Than Bloom and Cuckoo Filters (Graf and Lemire, JEA 2020)
+ */
+class XorFilter : public Filter {
+    uint64_t seed = 0;
+    unsigned long int block_length;
+    unsigned int bits;
+    //fingerprints of bits bits each, packed
+    std::vector<uint64_t> table;
+    uint64_t hash(int x);
+    unsigned long int slot(uint64_t h, int i);
+    uint32_t fingerprint(uint64_t h);
+    uint32_t get(unsigned long int i);
+    void set(unsigned long int i, uint32_t value);
+    XorFilter(){};
+
+public:
+    XorFilter(const std::vector<int>& keys, double falsePosRate);
+    bool possiblyContains(int data);
+    unsigned long int size_in_bits();
+    static unsigned int fingerprint_bits(double falsePosRate);
+    void write(std::ostream& out);
+    static XorFilter* read(std::istream& in);
+};
+
+#endif /* Xor_Filter_hpp */
@@ -11,11 +11,42 @@
 #include <fstream>
 #include "LSM.hpp"
 #include "Tree.hpp"
+#include "Sharded_Tree.hpp"
+#include "Engine.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Trace.hpp"
 #include "Bloom_Filter.hpp"
 #include <chrono>
+#include <atomic>
+#include <new>
+#include <assert.h>
 
 using namespace std::chrono;
 
+#ifdef COUNT_ALLOCATIONS
+/*
+ Count the heap allocations of the whole program, for allocation_test;
+ only built with -DCOUNT_ALLOCATIONS so the server, client and replay runs don't pay for it
+ */
+static std::atomic<unsigned long> allocations(0);
+
+void* operator new(std::size_t size){
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if(p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept{
+    free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept{
+    free(p);
+}
+#endif
+
 void bloomfilter_test(){
     BloomFilter bl = BloomFilter(20000, 0.01);
     for(int i = 0; i < 5000; i+=2){
@@ -55,6 +86,31 @@ void bloomfilter_test(){
     }
 }
 
+void filter_test(){
+    std::vector<int> keys;
+    for(int i = 0; i < 100000; i+=2){
+        keys.push_back(i);
+    }
+    double rates[3] = {0.1, 0.01, 0.001};
+    for(int r = 0; r < 3; r++){
+        for(int t = 0; t < 2; t++){
+            Filter* filter = create_filter(keys, rates[r], t == 0 ? FILTER_BLOOM : FILTER_XOR);
+            int negatives = 0;
+            for(int i = 0; i < keys.size(); i++){
+                if(!filter->possiblyContains(keys[i])) negatives += 1;
+            }
+            int positives = 0;
+            for(int i = 200000; i < 300000; i++){
+                if(filter->possiblyContains(i)) positives += 1;
+            }
+            std::cout << (t == 0 ? "bloom" : "xor") << " p=" << rates[r] << ": "
+            << (double)filter->size_in_bits()/keys.size() << " bits per key, "
+            << negatives << " false negatives, false positive rate " << positives/100000.0 << std::endl;
+            delete filter;
+        }
+    }
+}
+
 void read_file(std::string name, unsigned long size){
     std::ifstream file(name, std::ios::binary);
     KVpair* array = new KVpair[size];
@@ -72,8 +128,8 @@ void create_file(){
     std::string name = "yourFile";
     std::ofstream stream(name.c_str(), std::ios::binary);
     KVpair array[2];
-    array[0] = {3,4,true};
-    array[1] = {7,8,false};
+    array[0] = {3,4,true,false,0};
+    array[1] = {7,8,false,false,0};
     stream.write((char*) array, 2*sizeof(KVpair));
     stream.close();
     std::cout<<"finished"<<std::endl;
@@ -112,10 +168,10 @@ void tree_test(){
     }
 //    for(int i = 0; i < my_tree.layers.size();i++){
 //        std::cout<<"the layer "<<i<<std::endl;
-//        for(int j = 0; j < parameters::NUM_RUNS; j++){
-//            if(my_tree.layers.at(i).run_size[j] != 0){
+//        for(int j = 0; j < my_tree.layers.at(i).num_runs(); j++){
+//            if(my_tree.layers.at(i).get_run(j).size != 0){
 //                std::cout<<"In the file "<<my_tree.layers.at(i).get_name(j)<<std::endl;
-//                read_file(my_tree.layers.at(i).get_name(j), my_tree.layers.at(i).run_size[j]);
+//                read_file(my_tree.layers.at(i).get_name(j), my_tree.layers.at(i).get_run(j).size);
 //            }
 //        }
 //    }
@@ -139,10 +195,10 @@ void tree_test_2(){
     }
     //    for(int i = 0; i < my_tree.layers.size();i++){
     //        std::cout<<"the layer "<<i<<std::endl;
-    //        for(int j = 0; j < parameters::NUM_RUNS; j++){
-    //            if(my_tree.layers.at(i).run_size[j] != 0){
+    //        for(int j = 0; j < my_tree.layers.at(i).num_runs(); j++){
+    //            if(my_tree.layers.at(i).get_run(j).size != 0){
     //                std::cout<<"In the file "<<my_tree.layers.at(i).get_name(j)<<std::endl;
-    //                read_file(my_tree.layers.at(i).get_name(j), my_tree.layers.at(i).run_size[j]);
+    //                read_file(my_tree.layers.at(i).get_name(j), my_tree.layers.at(i).get_run(j).size);
     //            }
     //        }
     //    }
@@ -182,8 +238,8 @@ void workload(Tree* my_tree, std::string file_name){
     std::string out_name = "serial_out_" + file_name;
     std::ofstream output(out_name);
     if (file.is_open()) {
-        while (!file.eof()) {
-            file >> action;
+        //stop on the first failed read, so the last operation isn't done twice
+        while (file >> action) {
             if (action == 'p') {
                 file >> key;
                 file >> value;
@@ -246,16 +302,522 @@ void range_test(){
 }
 
 
+/*
+ Compare the I/O backends on point lookups, one key at a time and in batches
+ */
+void io_backend_test(){
+    Tree my_tree;
+    for(int i = 0; i < 500000; i++){
+        my_tree.put((int)(((long)i*7919)%1000003), i);
+    }
+    std::vector<int> keys;
+    for(int i = 0; i < 20000; i++){
+        keys.push_back(rand()%1000003);
+    }
+    IOBackendType types[3] = {IO_SYNC, IO_THREADPOOL, IO_URING};
+    for(int t = -1; t < 3; t++){
+        IOBackend* backend = NULL;
+        std::string name = "stream";
+        if(t >= 0){
+            backend = create_io_backend(types[t], 32);
+            name = backend->name();
+        }
+        my_tree.set_io_backend(backend);
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        int query = 0;
+        int hits = 0;
+        for(int i = 0; i < keys.size(); i++){
+            if(my_tree.get(keys.at(i), query)) hits++;
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::vector<int> values;
+        std::vector<bool> found;
+        for(int i = 0; i < keys.size(); i += 256){
+            std::vector<int> batch(keys.begin()+i, keys.begin()+std::min(i+256, (int)keys.size()));
+            my_tree.get_batch(batch, values, found);
+        }
+        high_resolution_clock::time_point t3 = high_resolution_clock::now();
+        std::cout << name << ": " << hits << " hits, single "
+        << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds, batched "
+        << duration_cast<microseconds>( t3 - t2 ).count() << " microseconds" << std::endl;
+        my_tree.set_io_backend(NULL);
+        delete backend;
+    }
+}
+
+void sharded_test(){
+    ShardedTree my_tree(4, Options(), "shards", true, true);
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    std::vector<Operation> batch;
+    for(int i = 0; i < 1000000; i++){
+        Operation op;
+        op.type = OP_PUT;
+        op.key = (int)(((long)i*7919)%1000003);
+        op.value = i;
+        batch.push_back(op);
+        if(batch.size() == 4096){
+            my_tree.apply_batch(batch);
+            batch.clear();
+        }
+    }
+    my_tree.apply_batch(batch);
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    std::vector<KVpair> result = my_tree.range(1000, 2000);
+    std::cout << my_tree.num_shards() << " shards: "
+    << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds to load, "
+    << result.size() << " keys in [1000, 2000)" << std::endl;
+}
+
+void row_cache_test(){
+    //1% of the keys get 60% of the reads
+    std::vector<int> keys;
+    for(int i = 0; i < 200000; i++){
+        keys.push_back(rand()%100 < 60 ? rand()%5000 : rand()%500000);
+    }
+    for(int t = 0; t < 2; t++){
+        Options options;
+        options.row_cache_entries = t == 0 ? 0 : 8192;
+        Tree my_tree(options);
+        for(int i = 0; i < 500000; i++){
+            my_tree.put((int)(((long)i*7919)%500009), i);
+        }
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        int query = 0;
+        int hits = 0;
+        for(int i = 0; i < keys.size(); i++){
+            if(my_tree.get(keys.at(i), query)) hits++;
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (t == 0 ? "no row cache: " : "row cache: ") << hits << " hits, "
+        << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+}
+
+void bulk_load_test(){
+    std::ofstream file("bulk_input", std::ios::binary);
+    for(int i = 0; i < 1000000; i++){
+        int32_t pair[2] = {(int)(((long)i*7919)%1000003), i};
+        file.write((char*)pair, sizeof(pair));
+    }
+    file.close();
+    {
+        Tree my_tree;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        std::ifstream input("bulk_input", std::ios::binary);
+        int32_t pair[2];
+        while(input.read((char*)pair, sizeof(pair))){
+            my_tree.put(pair[0], pair[1]);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << "put one by one: " << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+    {
+        Tree my_tree;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        my_tree.bulk_load("bulk_input", 4*1024*1024);
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << "bulk load: " << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+    remove("bulk_input");
+}
+
+void aggregate_test(){
+    Options opts;
+    opts.page_summaries = true;
+    Tree my_tree(opts);
+    for(int i = 0; i < 1000000; i++){
+        my_tree.put(i, i%1000);
+    }
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    std::vector<KVpair> res = my_tree.range(0, 1000000);
+    long long sum = 0;
+    for(int i = 0; i < res.size(); i++){
+        sum += res[i].value;
+    }
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    Aggregate agg = my_tree.aggregate(0, 1000000);
+    high_resolution_clock::time_point t3 = high_resolution_clock::now();
+    std::cout << "range then sum: " << sum << " in " << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    std::cout << "aggregate: " << agg.sum << " in " << duration_cast<microseconds>( t3 - t2 ).count() << " microseconds, "
+    << agg.summarized_pages << " pages from their summary" << std::endl;
+}
+
+/*
+ Point lookups must not allocate once the buffers of the thread have grown, with or without
+ an I/O backend, needs a build with -DCOUNT_ALLOCATIONS
+ */
+void allocation_test(){
+#ifndef COUNT_ALLOCATIONS
+    std::cout << "allocation_test needs a build with -DCOUNT_ALLOCATIONS" << std::endl;
+#else
+    Tree my_tree;
+    for(int i = 0; i < 200000; i++){
+        my_tree.put((int)(((long)i*7919)%1000003), i);
+    }
+    for(int i = 0; i < 200000; i += 1000){
+        my_tree.del((int)(((long)i*7919)%1000003));
+    }
+    //without a backend, then with each of them reading the candidate runs of a key together
+    for(int type = -1; type <= IO_URING; type++){
+        IOBackend* io = type < 0 ? NULL : create_io_backend((IOBackendType)type, 8);
+        my_tree.set_io_backend(io);
+        int value;
+        for(int i = 0; i < 1000; i++){
+            my_tree.get(rand()%1000003, value);
+        }
+        unsigned long found = 0;
+        unsigned long before = allocations.load();
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 100000; i++){
+            if(my_tree.get(rand()%1000003, value)) found += 1;
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        unsigned long count = allocations.load() - before;
+        std::cout << (io == NULL ? "no backend" : io->name()) << ": 100000 gets, " << found << " found, " << count << " heap allocations, "
+        << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+        assert(count == 0);
+        my_tree.set_io_backend(NULL);
+        delete io;
+    }
+#endif
+}
+
+/*
+ Memory of the fence indexes against an array of {min, max} per page,
+ and lookups with the deep levels reading their index blocks on demand
+ */
+void fence_index_test(){
+    for(int lazy = 0; lazy < 2; lazy++){
+        Options opts;
+        opts.kvpair_per_page = 64;
+        if(lazy){
+            opts.fence_cache_bytes = 16*1024;
+            opts.lazy_fence_rank = 1;
+        }
+        Tree my_tree(opts);
+        for(int i = 0; i < 2000000; i++){
+            my_tree.put((int)(((long)i*7919)%2000003), i);
+        }
+        unsigned long pages = 0;
+        unsigned long bytes = 0;
+        for(int i = 0; i < my_tree.layers.size(); i++){
+            for(int j = 0; j < my_tree.layers[i].num_runs(); j++){
+                const Run& run = my_tree.layers[i].get_run(j);
+                if(run.index == NULL) continue;
+                pages += run.index->num_pages();
+                bytes += run.index->size_in_bytes();
+            }
+        }
+        int value;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 100000; i++){
+            my_tree.get(rand()%2000003, value);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (lazy ? "lazy from level 1: " : "in memory: ") << pages << " pages, " << bytes
+        << " bytes of index instead of " << pages*sizeof(FencePointer) << ", 100000 gets in "
+        << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+}
+
+/*
+ Writes with the flushes and merges limited to 32MB/s, boosted 4 times when behind
+ */
+void rate_limiter_test(){
+    for(int limited = 0; limited < 2; limited++){
+        Options opts;
+        if(limited) opts.rate_limit = 32*1024*1024;
+        Tree my_tree(opts);
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 1000000; i++){
+            my_tree.put((int)(((long)i*7919)%1000003), i);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (limited ? "limited: " : "unlimited: ") << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds";
+        if(limited){
+            std::cout << ", flushes wrote " << my_tree.get_rate_limiter()->bytes[PRIORITY_FLUSH] << " bytes and waited "
+            << my_tree.get_rate_limiter()->waited[PRIORITY_FLUSH] << " microseconds, merges wrote "
+            << my_tree.get_rate_limiter()->bytes[PRIORITY_COMPACTION] << " bytes and waited "
+            << my_tree.get_rate_limiter()->waited[PRIORITY_COMPACTION] << " microseconds";
+        }
+        std::cout << std::endl;
+    }
+}
+
+/**
+ Keys written in order land in disjoint runs, which are concatenated instead of merged;
+ shuffled keys go through the full merges
+ */
+void sequential_ingest_test(){
+    for(int shuffled = 0; shuffled < 2; shuffled++){
+        Tree my_tree;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 1000000; i++){
+            my_tree.put(shuffled ? (int)(((long)i*7919)%1000003) : i, i);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (shuffled ? "shuffled: " : "sequential: ") << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+}
+
+/**
+ Lookups and short ranges over pages the OS has cached, with each page search kernel
+ */
+void page_search_test(){
+    Tree my_tree;
+    for(int i = 0; i < 1000000; i++){
+        my_tree.put((int)(((long)i*7919)%1000003), i);
+    }
+    for(int kernel = KERNEL_SCALAR; kernel <= KERNEL_AVX2; kernel++){
+        if(!set_page_search_kernel((PageSearchKernel)kernel)) continue;
+        int value = 0;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 200000; i++){
+            my_tree.get((int)(((long)i*104729)%1000003), value);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        unsigned long pairs = 0;
+        for(int i = 0; i < 20000; i++){
+            int low = (int)(((long)i*104729)%1000003);
+            pairs += my_tree.range(low, low + 100).size();
+        }
+        high_resolution_clock::time_point t3 = high_resolution_clock::now();
+        std::cout << (kernel == KERNEL_SCALAR ? "scalar: " : "avx2: ") << duration_cast<microseconds>( t2 - t1 ).count()
+        << " microseconds for the gets, " << duration_cast<microseconds>( t3 - t2 ).count()
+        << " microseconds for the ranges (" << pairs << " pairs)" << std::endl;
+    }
+}
+
+/**
+ Record the flushes, merges and slow operations of a load, open trace.json
+ in chrome://tracing or ui.perfetto.dev to see them on a timeline
+ */
+void event_trace_test(){
+    Options opts;
+    opts.trace_events = 100000;
+    opts.trace_slow_micros = 200;
+    Tree my_tree(opts);
+    int value = 0;
+    for(int i = 0; i < 1000000; i++){
+        my_tree.put((int)(((long)i*7919)%1000003), i);
+        if(i % 10 == 0) my_tree.get((int)(((long)i*104729)%1000003), value);
+    }
+    std::cout << my_tree.get_event_tracer()->num_events() << " events, exported: "
+    << my_tree.get_event_tracer()->export_json("trace.json") << std::endl;
+}
+
+/**
+ Counters updated with a get and a put, then with the add operator
+ */
+void merge_operator_test(){
+    AddOperator add;
+    Options opts;
+    opts.merge_operator = &add;
+    for(int blind = 0; blind < 2; blind++){
+        Tree my_tree(opts);
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 1000000; i++){
+            int key = (int)(((long)i*7919)%100003);
+            if(blind){
+                my_tree.merge(key, 1);
+            }else{
+                int value = 0;
+                my_tree.get(key, value);
+                my_tree.put(key, value + 1);
+            }
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        int value = 0;
+        my_tree.get(0, value);
+        std::cout << (blind ? "merge: " : "get and put: ") << duration_cast<microseconds>( t2 - t1 ).count()
+        << " microseconds, counter of key 0: " << value << std::endl;
+    }
+}
+
+/*
+ Many keyspaces, most of the writes going to one of them: separate trees each hold a
+ buffer and a pool of merge workers, the keyspaces of an engine share them
+ */
+void keyspace_test(){
+    const int num_keyspaces = 64;
+    Options opts;
+    opts.data_dir = "keyspaces";
+    for(int shared = 0; shared < 2; shared++){
+        Engine engine(opts, 4*opts.buffer_capacity*sizeof(KVpair));
+        std::vector<Tree*> trees;
+        for(int i = 0; i < num_keyspaces; i++){
+            Options tree_opts = opts;
+            tree_opts.data_dir = "keyspaces/tree_" + std::to_string(i);
+            trees.push_back(shared ? engine.create_keyspace("keyspace_" + std::to_string(i)) : new Tree(tree_opts));
+        }
+        unsigned long peak = 0;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 2000000; i++){
+            //nine writes in ten go to the first keyspace
+            int k = i % 10 == 0 ? 1 + (i/10) % (num_keyspaces - 1) : 0;
+            trees[k]->put((int)(((long)i*7919)%1000003), i);
+            if(i % 1000 == 0){
+                unsigned long buffered = 0;
+                for(int j = 0; j < num_keyspaces; j++) buffered += trees[j]->buffer_bytes();
+                peak = std::max(peak, buffered);
+            }
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (shared ? "engine: " : "separate trees: ") << duration_cast<microseconds>( t2 - t1 ).count()
+        << " microseconds, peak buffered bytes " << peak << ", flushes for the budget " << engine.budget_flushes << std::endl;
+        if(!shared){
+            for(int i = 0; i < num_keyspaces; i++) delete trees[i];
+        }
+    }
+}
+
+/*
+ The same small writes one call at a time and in batches of 100
+ */
+void write_batch_test(){
+    for(int batched = 0; batched < 2; batched++){
+        Tree my_tree;
+        WriteBatch batch;
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 1000000; i++){
+            int key = (int)(((long)i*7919)%1000003);
+            if(!batched){
+                my_tree.put(key, i);
+                continue;
+            }
+            batch.put(key, i);
+            if(batch.count() == 100){
+                my_tree.write(batch);
+                batch.clear();
+            }
+        }
+        my_tree.write(batch);
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (batched ? "batches: " : "puts: ") << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+    }
+}
+
+/*
+ The memory held at its peak while the levels fill up, without a limit and with one
+ that the merges of the deep levels have to shrink their chunks for
+ */
+void memory_limit_test(){
+    for(int limited = 0; limited < 2; limited++){
+        Options opts;
+        opts.read_ahead_pages = 256;
+        opts.write_behind_pages = 256;
+        if(limited) opts.memory_limit = 1 << 20;
+        Tree my_tree(opts);
+        high_resolution_clock::time_point t1 = high_resolution_clock::now();
+        for(int i = 0; i < 2000000; i++){
+            my_tree.put((int)(((long)i*7919)%2000003), i);
+        }
+        high_resolution_clock::time_point t2 = high_resolution_clock::now();
+        std::cout << (limited ? "1MB limit: " : "no limit: ") << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds" << std::endl;
+        std::cout << my_tree.get_memory_tracker()->report() << std::endl;
+    }
+}
+
+/*
+ Checkpoint a tree and open the checkpoint in another tree, neither reads a run
+ */
+void checkpoint_test(){
+    Options opts;
+    opts.data_dir = "checkpoint_source";
+    Tree my_tree(opts);
+    for(int i = 0; i < 2000000; i++){
+        my_tree.put((int)(((long)i*7919)%2000003), i);
+    }
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    bool taken = my_tree.checkpoint("checkpoint");
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    //the merges after the checkpoint remove their inputs, the checkpoint keeps its links
+    for(int i = 0; i < 1000000; i++){
+        my_tree.put(i, -i);
+    }
+    Options restored_opts;
+    restored_opts.data_dir = "checkpoint_restored";
+    Tree restored(restored_opts);
+    high_resolution_clock::time_point t3 = high_resolution_clock::now();
+    bool opened = taken && restored.restore("checkpoint");
+    high_resolution_clock::time_point t4 = high_resolution_clock::now();
+    int value = 0;
+    restored.get(0, value);
+    std::cout << "checkpoint: " << duration_cast<microseconds>( t2 - t1 ).count() << " microseconds, restore: "
+    << duration_cast<microseconds>( t4 - t3 ).count() << " microseconds, " << (opened ? "value of key 0: " : "failed ") << value << std::endl;
+}
 
 int main(int argc, const char * argv[]) {
+    /*
+     LSM_Tree server <address> [sync|threadpool|io_uring] [queue depth]
+     the lookups of the server go through io_uring by default, the LSM_Server target builds it alone
+     LSM_Tree client <address> [connections] [depth] [requests] [key range] [get ratio]
+     address is "unix:<path>" or "<host>:<port>"
+     LSM_Tree convert <text workload> <trace>
+     LSM_Tree replay <trace> [threads] [shards]
+     with more than one thread, the trace is replayed on a sharded tree, 4 shards by default,
+     one thread per shard at most
+     */
+    if(argc >= 3 && std::string(argv[1]) == "server"){
+        return serve(argv[2], argc > 3 ? argv[3] : "io_uring", argc > 4 ? atoi(argv[4]) : 32);
+    }
+    if(argc >= 3 && std::string(argv[1]) == "client"){
+        load_client(argv[2], argc > 3 ? atoi(argv[3]) : 4, argc > 4 ? atoi(argv[4]) : 64,
+                    argc > 5 ? atol(argv[5]) : 1000000, argc > 6 ? atoi(argv[6]) : 1000000,
+                    argc > 7 ? atof(argv[7]) : 0.5);
+        return 0;
+    }
+    if(argc >= 4 && std::string(argv[1]) == "convert"){
+        if(!convert_trace(argv[2], argv[3])){
+            std::cout << "Could not convert " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if(argc >= 3 && std::string(argv[1]) == "replay"){
+        std::vector<TraceOperation> operations;
+        if(!load_trace(argv[2], operations)){
+            std::cout << "Could not load " << argv[2] << std::endl;
+            return 1;
+        }
+        int threads = argc > 3 ? atoi(argv[3]) : 1;
+        ReplayResult result;
+        if(threads <= 1){
+            Tree my_tree;
+            result = replay_trace(&my_tree, operations);
+        }else{
+            ShardedTree my_tree(argc > 4 ? atoi(argv[4]) : 4, Options(), "shards");
+            result = replay_trace(&my_tree, operations, threads);
+        }
+        std::cout << result.operations << " operations in " << result.microseconds << " microseconds, "
+        << result.found << " keys found, " << result.range_pairs << " pairs in ranges" << std::endl;
+        return 0;
+    }
     //merge_test_file();
     //read_file("run_1_0", 3);
     //read_file("run_1_1", 3);
     //bloomfilter_test();
+    //filter_test();
     //create_file();
     main_test();
     //tree_test();
     //range_test();
+    //io_backend_test();
+    //sharded_test();
+    //row_cache_test();
+    //bulk_load_test();
+    //aggregate_test();
+    //allocation_test();
+    //fence_index_test();
+    //rate_limiter_test();
+    //sequential_ingest_test();
+    //page_search_test();
+    //event_trace_test();
+    //merge_operator_test();
+    //keyspace_test();
+    //write_batch_test();
+    //memory_limit_test();
+    //checkpoint_test();
 }
 
 